@@ -8,16 +8,46 @@
 #include <iostream> // needed for the << operator
 #include <memory> // needed for unique pointers
 #include <vector> 
+#include <algorithm> // needed for sorting in bulk_insert
+#include <thread> // needed for the parallel sort in bulk_insert
+#include <atomic> // needed for the parallel copy
+#include <type_traits> // needed for std::is_same
+#include <exception> // needed for std::exception_ptr in the parallel visits
+#include <system_error> // needed for the failures of std::thread
+#include <functional> // needed for std::less
+#include <stdexcept> // needed for std::out_of_range
+#include <tuple> // needed for std::forward_as_tuple
+#include "BST_Policies.h"
+#include "BST_Frozen.h"
 
 #ifndef BST_H__
 #define BST_H__
 
+/**
+ * @brief Output formats of BST::exportStructure.
+ */
+enum class ExportFormat
+{
+	/** A Graphviz digraph, one statement per node and per edge. */
+	dot,
+	/** A JSON object holding the flat list of the nodes, the children referred to by id. */
+	json,
+	/** One line per level, the children of every node of the level above in order, null children marked with #. */
+	level_order
+};
+
 /**
  * @brief Implementation of a template binary search tree.
  * @tparam TK Type of the key of a node.
  * @tparam TV Type of the value of a node.
+ * @tparam Balancing Balancing policy of the tree: NoBalancing (default) or AVLBalancing, see BST_Policies.h.
+ * @tparam Allocation Allocation policy of the nodes: HeapAllocation (default) or ArenaAllocation, see BST_Policies.h.
+ * @tparam Compare Comparison object ordering the keys. With a transparent comparator such as std::less<>, find and operator[]
+ * accept any type comparable with TK (e.g. const char* for std::string keys) without building a TK.
+ * @tparam Stats Statistics policy: NoStats (default, no cost at all) or CountingStats, which counts comparisons, lookup
+ * depths and node allocations, see stats() and BST_Policies.h.
  */
-template <class TK,class TV>
+template <class TK,class TV,class Balancing = NoBalancing,class Allocation = HeapAllocation,class Compare = std::less<TK>,class Stats = NoStats>
 class BST
 {
 private:
@@ -35,75 +65,268 @@ public:
 	 * @brief A const iterator for the binary search tree.
 	 */
 	class ConstIterator;
+	/**
+	 * @brief A pair of iterators delimiting a part of the tree, usable in range-based for loops.
+	 */
+	class Range;
 
 private:
+	/** Owning pointer to a node, its deleter is given by the allocation policy. */
+	using NodePtr = std::unique_ptr<Node, typename Allocation::template deleter<Node>>;
+
+	/** Pool from which the nodes are allocated. It is declared before root so that it outlives the nodes. */
+	typename Allocation::template pool<Node> nodes;
+
+	/** Statistics recorder, updated by constant lookups too. It is declared before root so that it can count the first node. */
+	mutable Stats recorder;
+
 	/** Root node of the binary search tree. */
-	std::unique_ptr<Node> root;
+	NodePtr root;
+
+	/** Comparison object ordering the keys. */
+	Compare comp;
+
+	/**
+	 * @brief Private method creating a node from the pool, counted by the statistics policy.
+	 * @param args The arguments forwarded to the constructor of the node.
+	 */
+	template <class... Args>
+	Node* createNode(Args&&... args)
+	{
+		Node* n = nodes.create(std::forward<Args>(args)...);
+		recorder.allocated(1, sizeof(Node));
+		return n;
+	}
+	/**
+	 * @brief Private method giving a node back to the pool, counted by the statistics policy.
+	 * @param n The node to be destroyed.
+	 */
+	void destroyNode(Node* n) noexcept
+	{
+		nodes.destroy(n);
+		recorder.freed(1, sizeof(Node));
+	}
+
+	/**
+	 * @brief Private method to find the node with a given key.
+	 * @param key The key to be found, of any type the comparison object accepts.
+	 * @return Node* The node with the key, nullptr if the key is not present.
+	 */
+	template <class K>
+	Node* findNode(const K& key) const;
 
-	/** Number of nodes in the binary search tree */
-	int size;
+	/**
+	 * @brief Private method to look for the position of a key and link a new node there if the key is not present.
+	 * @param key The key to be inserted.
+	 * @param make Function taking the parent of the new node and returning the new node, called only if the key is not present.
+	 * @return std::pair<Node*, bool> The node with the key and true if the node has just been created.
+	 */
+	template <class K, class F>
+	std::pair<Node*, bool> insertNode(const K& key, F make);
 
-	/** Number of horizontal layers (generations) in the binary search tree. */
-	int height;
+	/**
+	 * @brief Private method building the value of a key in place if the key is not present.
+	 * @param key The key, forwarded to the node only if the node is created.
+	 * @param args The arguments forwarded to the constructor of the value.
+	 */
+	template <class K, class... Args>
+	std::pair<Node*, bool> tryEmplaceNode(K&& key, Args&&... args);
 
 	/**
-	 * @brief Recursive private method to create a deep copy of a binary search tree given the root node.
-	 * @param node The root node of the tree that should be copied.
+	 * @brief Private method cloning the descendants of a node below a node of this tree, with the same shape.
+	 * @param s The source node, its children are cloned.
+	 * @param d The clone of s, it must have no children yet.
+	 * @param cut Depth (below s) at which the visit stops, negative for no limit.
+	 * @param pending Where the pairs (source, clone) of the nodes reached at depth cut are stored, their children are not cloned.
+	 *
+	 * The source is visited without recursion nor stack, going back up through the parent pointers.
 	 */
-	void copy(const std::unique_ptr<Node>& node);
+	void cloneChildren(const Node* s, Node* d, int cut, std::vector<std::pair<const Node*, Node*>>* pending);
 
 	/**
-	 * @brief Recursive private method to builds a balanced tree from an ordered vector of key-value pairs.
-	 * @param v Orderer vector of  key-value pairs.
+	 * @brief Private method making this empty tree a copy of bst with exactly the same shape, in O(n) and without comparisons.
+	 * @param bst The tree to be copied.
+	 * @param threads Number of threads cloning disjoint subtrees, used only with HeapAllocation.
+	 */
+	void copy(const BST& bst, unsigned threads);
+
+	/**
+	 * @brief Recursive private method to builds a balanced tree from an ordered vector of detached nodes.
+	 * @param v Ordered vector of nodes, none of them owns its children.
 	 * @param start The index representing the starting point in the vector, information needed for the recursion.
 	 * @param end The index representing the ending point in the vector, information needed for the recursion.
+	 * @param parent The node which will be the parent of the root of the rebuilt subtree.
+	 * @return NodePtr The owning pointer to the root of the rebuilt subtree.
+	 *
+	 * The nodes are relinked as they are: no key or value is copied and nothing is allocated.
 	 */
-	void rebuildBalancedTree(std::vector<std::pair<TK, TV>>& v, int start, int end);
+	NodePtr rebuildBalancedTree(std::vector<Node*>& v, int start, int end, Node* parent);
+
+	/**
+	 * @brief Sorts key-value pairs by key, keeping equal keys in their original order.
+	 * @param v The vector to be sorted.
+	 * @param threads Number of threads: the vector is split in chunks sorted concurrently and then merged.
+	 */
+	void sortByKey(std::vector<std::pair<TK, TV>>& v, unsigned threads) const;
+
+	/**
+	 * @brief Detaches all the nodes from the tree and returns them in ascending key order.
+	 *
+	 * After the call the tree is empty but the nodes are still alive: they must be relinked with rebuildBalancedTree.
+	 */
+	std::vector<Node*> flatten();
+
+	/**
+	 * @brief Private method visiting ranges on a pool of threads, each thread taking the next range until none is left.
+	 * @param ranges The ranges to be visited.
+	 * @param threads Number of threads.
+	 * @param visit Function taking the index of a range.
+	 */
+	template <class F>
+	static void visitRanges(const std::vector<Range>& ranges, unsigned threads, F visit);
+
+	/**
+	 * @brief Private method destroying a detached subtree without recursion, see clear.
+	 * @param n The root of the subtree, it may be nullptr.
+	 */
+	void destroySubtree(Node* n) noexcept;
+
+	/**
+	 * @brief Private method returning s with quotes, backslashes and control characters escaped, for DOT and JSON strings.
+	 */
+	static std::string escaped(const std::string& s);
+
+	/**
+	 * @brief Private method joining two detached subtrees and a middle node, all the keys of l being lower than k and all the keys of r greater.
+	 * @param l The subtree of the lower keys, it may be empty.
+	 * @param k The middle node, its children are replaced.
+	 * @param r The subtree of the greater keys, it may be empty.
+	 * @return NodePtr The joined subtree, without parent.
+	 *
+	 * With a self-balancing policy the shorter subtree is hung on the spine of the taller one, at the level of its own height,
+	 * and the spine is rebalanced on the way back: O(|h(l) - h(r)| + 1). Otherwise k simply becomes the root, in O(1).
+	 */
+	NodePtr joinNodes(NodePtr l, NodePtr k, NodePtr r);
+	/**
+	 * @brief Private method joining two detached subtrees without a middle node: the greatest node of l is taken as middle node.
+	 */
+	NodePtr joinNodes(NodePtr l, NodePtr r);
+	/**
+	 * @brief Private method splitting a detached subtree around a key, without recursion.
+	 * @param t The subtree to be split.
+	 * @param key The key.
+	 * @param l Receives the nodes with keys lower than key.
+	 * @param m Receives the node with the key, if present, without children.
+	 * @param r Receives the nodes with keys greater than key.
+	 *
+	 * The path to the key is cut: the pieces hanging on its left (right) are joined from the bottom up into l (r).
+	 */
+	void splitNodes(NodePtr t, const TK& key, NodePtr& l, NodePtr& m, NodePtr& r);
+	/**
+	 * @brief Private method implementing union_with, intersect_with and difference_with on two detached subtrees.
+	 * @param a The subtree of this tree.
+	 * @param b The subtree of the other tree.
+	 * @param op 0 for the union, 1 for the intersection, 2 for the difference.
+	 * @param threads Number of threads available to recurse on the two halves.
+	 * @return NodePtr The resulting subtree, the nodes not in it are destroyed.
+	 *
+	 * b is split around the key of the root of a, the two halves are combined recursively with the children of a and
+	 * joined back with (or without) the root of a.
+	 */
+	NodePtr combineNodes(NodePtr a, NodePtr b, int op, unsigned threads);
+	/**
+	 * @brief Private method preparing the set operations with other: shares its memory and bounds the height of this tree.
+	 */
+	void prepareCombine(BST& other);
+
+	/**
+	 * @brief Returns the owning pointer of a node: the root pointer or the left/right pointer of its parent.
+	 * @param node The node whose owner is requested.
+	 */
+	NodePtr& owner(Node* node) noexcept;
+
+	/**
+	 * @brief Walks from a node up to the root, updating the heights and letting the balancing policy rotate the subtrees.
+	 * @param node The first node to be updated, usually the parent of a node just inserted.
+	 */
+	void retrace(Node* node);
 
-	
 
 public:
 	/**
 	 * @brief Default constructor for the binary search tree.
 	 */
-	BST(): size{0}, height{0} {}
+	BST() {}
 	
 	/**
 	 * @brief Constructor for the binary search tree given a root node.
 	 * @param d The key,value pair for the root node.
 	 */
-	BST(std::pair<TK, TV> d): root{new Node{d}}, size{1}, height{1} {}
+	BST(std::pair<TK, TV> d): root{createNode(d)} {}
 	
+	/**
+	 * @brief Constructor for the binary search tree given a range of key,value pairs.
+	 * @param first Iterator to the first pair of the range.
+	 * @param last Iterator past the last pair of the range.
+	 * @param threads Number of threads used to sort the pairs if the range is not sorted.
+	 *
+	 * The tree is built balanced, see bulk_insert.
+	 */
+	template <class InputIt>
+	BST(InputIt first, InputIt last, unsigned threads = 1) { bulk_insert(first, last, threads); }
+
 	/**
 	 * @brief Copy constructor for the binary search tree. It initializes a BST class by making a copy of an object of the same class.
 	 * @param bst The BST to be copied.
 	 * 
-	 * The constructor uses the recursive private copy method.
+	 * The copy has the same shape as bst: it is built in O(n), without comparing keys and without recursion.
+	 */
+	BST(const BST& bst) : comp{bst.comp} { copy(bst, 1); }
+
+	/**
+	 * @brief Copy constructor cloning the subtrees of bst in parallel.
+	 * @param bst The BST to be copied.
+	 * @param threads Number of threads. The pool of ArenaAllocation is not thread safe, so with it the copy is sequential.
 	 */
-	BST(const BST& bst): size{1}, height{1} {copy(bst.root);}
+	BST(const BST& bst, unsigned threads) : comp{bst.comp} { copy(bst, threads); }
 
 	/**
 	 * @brief Move constructor for the binary search tree.
 	 * @param bst The binary search tree to be moved into a new one.
 	 */
-	BST(BST&& bst) noexcept : root{std::move(bst.root)}, size{1}, height{1} {}
+	BST(BST&& bst) noexcept : nodes{std::move(bst.nodes)}, root{std::move(bst.root)}, comp{std::move(bst.comp)} {}
 
 	/**
-	 * @brief default destructor 
+	 * @brief Destructor, it destroys the nodes and gives their memory back to the pool.
 	 */
-    ~BST() noexcept = default;
+	~BST() noexcept { clear(); }
 
 	/** 
 	 * @brief Return the number of nodes in the binary search tree.
+	 *
+	 * Every node counts the nodes of its subtree, the size of the tree is the count of the root.
+	 */
+	int getSize() const noexcept { return root ? root->count : 0; }
+
+	/**
+	 * @brief Returns a snapshot of the statistics of the tree.
+	 * @return TreeStats The counters recorded by the Stats policy since the last reset_stats (zero with NoStats),
+	 * together with the size, the height and the average depth of the nodes, measured by visiting the tree in O(n).
+	 *
+	 * An average depth far above log2(size) tells that the tree has degenerated and should be balanced.
 	 */
-	int getSize() const noexcept { return size; }
+	TreeStats stats() const;
+	/**
+	 * @brief Sets to zero the counters of the Stats policy.
+	 */
+	void reset_stats() noexcept { recorder.reset(); }
 
 	/** 
 	 * @brief Return the number of generations of the binary search tree
 	 *
-	 * The height is required for graphical purposes.
+	 * The height is stored in the root node and kept up to date by every modification of the tree.
 	 */
-	int getHeight() const noexcept { return height; }
+	int getHeight() const noexcept { return root ? root->height : 0; }
 
 	/**
 	 * @brief Insert a new node in the binary search tree.
@@ -111,12 +334,118 @@ public:
 	 * 
 	 * If a node with the same key is already present inside the tree, 
 	 * the insert method substitute the value associated to that key with the new one. 
+	 * With the AVLBalancing policy the path to the root is rebalanced after the insertion.
+	 */
+	void insert(const std::pair<TK, TV>& kv) { insert_or_assign(kv.first, kv.second); }
+	/**
+	 * @brief Insert a new node in the binary search tree, moving the key and the value into it.
+	 * @param kv The key,value pair to be inserted.
+	 */
+	void insert(std::pair<TK, TV>&& kv) { insert_or_assign(std::move(kv.first), std::move(kv.second)); }
+	/**
+	 * @brief Insert a key with its value or, if the key is already present, assign the value to it.
+	 * @param key The key.
+	 * @param value The value, forwarded (moved if it is an rvalue) to the node.
+	 * @return std::pair<Iterator, bool> An iterator to the node with the key and true if the node was created.
+	 */
+	template <class M>
+	std::pair<Iterator, bool> insert_or_assign(const TK& key, M&& value);
+	/**
+	 * @brief Same as insert_or_assign, the key is moved into the node if the node is created.
+	 */
+	template <class M>
+	std::pair<Iterator, bool> insert_or_assign(TK&& key, M&& value);
+	/**
+	 * @brief Builds a key,value pair in place from args and links it in the tree if its key is not already present.
+	 * @param args The arguments forwarded to the constructor of std::pair<const TK, TV>.
+	 * @return std::pair<Iterator, bool> An iterator to the node with the key and true if the node was inserted.
+	 *
+	 * As std::map::emplace, an existing value is not modified. The node is built before the key is looked up,
+	 * prefer try_emplace when the key is available.
+	 */
+	template <class... Args>
+	std::pair<Iterator, bool> emplace(Args&&... args);
+	/**
+	 * @brief Builds the value in place from args if the key is not present, otherwise does nothing.
+	 * @param key The key.
+	 * @param args The arguments forwarded to the constructor of TV, they are not touched if the key is present.
+	 * @return std::pair<Iterator, bool> An iterator to the node with the key and true if the node was inserted.
 	 */
-	void insert(const std::pair<TK, TV> kv);
+	template <class... Args>
+	std::pair<Iterator, bool> try_emplace(const TK& key, Args&&... args);
+	/**
+	 * @brief Same as try_emplace, the key is moved into the node if the node is created.
+	 */
+	template <class... Args>
+	std::pair<Iterator, bool> try_emplace(TK&& key, Args&&... args);
+	/**
+	 * @brief Insert all the key,value pairs of a range in the binary search tree.
+	 * @param first Iterator to the first pair of the range.
+	 * @param last Iterator past the last pair of the range.
+	 * @param threads Number of threads used to sort the pairs if the range is not sorted.
+	 *
+	 * If the range is already sorted by key it is used as it is, otherwise it is sorted (in parallel when threads > 1).
+	 * The pairs are then merged with the nodes already in the tree and the whole tree is rebuilt perfectly balanced in O(n).
+	 * As for insert, when a key appears more than once the last value wins.
+	 */
+	template <class InputIt>
+	void bulk_insert(InputIt first, InputIt last, unsigned threads = 1);
+	/**
+	 * @brief Removes the node with a given key, if present.
+	 * @param key The key to be removed.
+	 * @return int The number of removed nodes, 0 or 1.
+	 *
+	 * A node with two children is replaced by its successor, relinking the nodes (the keys are constant and never moved).
+	 * The heights and the counts are updated on the path to the root and, with AVLBalancing, the path is rebalanced.
+	 */
+	int erase(const TK& key);
 	/**
 	 * @brief Clears all the elements of the tree
+	 *
+	 * With a bulk-releasing allocation policy and trivially destructible keys and values the nodes are not visited at all:
+	 * the blocks holding them are freed at once. Otherwise the nodes are destroyed one by one without recursion, so that
+	 * even a degenerate tree of millions of nodes does not overflow the stack.
+	 */
+	void clear() noexcept;
+
+	/**
+	 * @brief Moves the nodes with keys not lower than key into a new tree, in O(log n) with AVLBalancing.
+	 * @param key The key at which the tree is split.
+	 * @return BST The tree with the keys not lower than key, this tree keeps the lower keys.
+	 *
+	 * No node is allocated or copied. With ArenaAllocation the two trees share the blocks of the nodes.
 	 */
-	void clear() { root.reset(); }
+	BST split(const TK& key);
+	/**
+	 * @brief Joins two trees, all the keys of left must be lower than all the keys of right.
+	 * @param left The tree of the lower keys, it is left empty.
+	 * @param right The tree of the greater keys, it is left empty.
+	 * @return BST A tree with the nodes of both, in O(log n) with AVLBalancing.
+	 */
+	static BST join(BST&& left, BST&& right);
+	/**
+	 * @brief Moves into this tree the nodes of other whose keys are not here, as for insert the values of other win.
+	 * @param other The other tree, it is left empty.
+	 * @param threads Number of threads, used only with HeapAllocation.
+	 *
+	 * The set operations split the other tree at the key of the root of this tree and recurse on the two halves,
+	 * in parallel for large halves, in O(m log(n/m + 1)) with AVLBalancing, m being the size of the smaller tree.
+	 * The existing nodes are relinked, none is allocated. With ArenaAllocation this tree shares the blocks of other.
+	 * Without a balancing policy this tree is balanced first if it is too high for the recursion.
+	 */
+	void union_with(BST&& other, unsigned threads = 1);
+	/**
+	 * @brief Keeps in this tree only the keys present in other, see union_with.
+	 * @param other The other tree, it is left empty.
+	 * @param threads Number of threads, used only with HeapAllocation.
+	 */
+	void intersect_with(BST&& other, unsigned threads = 1);
+	/**
+	 * @brief Removes from this tree the keys present in other, see union_with.
+	 * @param other The other tree, it is left empty.
+	 * @param threads Number of threads, used only with HeapAllocation.
+	 */
+	void difference_with(BST&& other, unsigned threads = 1);
 	/**
 	 * @brief Prints nodes in ascending key order.
 	 * @param os The stream to which nodes are sent.
@@ -129,7 +458,7 @@ public:
 	 * @param null_str string used to graphically represent the empty positions in the binary search tree.
 	 * @param empty char used as unit for graphical separation between nodes.
 
-	Uses the method getKeyString.
+	The grid has 2^height positions: trees taller than 20 levels are written with exportStructure in level order instead.
 	 */
 	void printStructure(std::string (&f)(TK), std::string null_str = "XXX", char empty = ' ') const;
 
@@ -138,16 +467,151 @@ public:
 
 	 */
 	std::string getKeyString(int index, std::string (&f)(TK), std::string null_str = "XXX") const;
+
+	/**
+	 * @brief Writes the structure of the tree to a stream, visiting every node once.
+	 * @param os The stream to which the structure is written.
+	 * @param format Graphviz DOT, JSON or level order, see ExportFormat.
+	 * @param key_format Function converting a key to a string, as in printStructure.
+	 * @param value_format Function converting a value to a string, nullptr to leave the values out.
+	 * @param max_depth Nodes deeper than max_depth (the root is at depth 0) are not written, negative for no limit.
+	 * @param max_nodes At most max_nodes nodes are written, negative for no limit.
+	 * @return std::ostream& The stream.
+	 *
+	 * DOT and JSON number the nodes in preorder and walk the tree through the parent pointers, without stack or recursion:
+	 * the time is linear and the memory constant whatever the shape. The level order keeps the nodes of one level in
+	 * memory. A subtree cut by max_depth is written as a marker with its number of nodes ("+12"); when max_nodes
+	 * stops DOT or JSON, the output ends with a truncation note (a comment, or "truncated": true).
+	 */
+	std::ostream& exportStructure(std::ostream& os, ExportFormat format, std::string (&key_format)(TK),
+	                              std::string (*value_format)(TV) = nullptr, int max_depth = -1, int max_nodes = -1) const;
 	/**
 	 * @brief Method used to find a node inside the binary search tree.
 	 * @param key The key of the node to be found.
 	 * @return Iterator An iterator to the node if the node was found, otherwise it returns an iterator to nullptr.
 	 */
-	Iterator find(TK key) const;
+	Iterator find(const TK& key) const { return Iterator{findNode(key)}; }
+	/**
+	 * @brief Heterogeneous lookup, available only with a transparent comparison object.
+	 * @param key A key of any type comparable with TK, no TK is built.
+	 */
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	Iterator find(const K& key) const { return Iterator{findNode(key)}; }
+	/**
+	 * @brief Looks up a batch of keys, writing one iterator per key (end() for the missing ones) in the order of the keys.
+	 * @param first Iterator to the first key of the batch.
+	 * @param last Iterator past the last key of the batch.
+	 * @param out Output iterator receiving the results.
+	 * @return OutputIt The output iterator past the last result.
+	 *
+	 * If the keys are sorted, each lookup starts from the position of the previous one: it climbs up through the first
+	 * right ancestors only as far as needed and then goes down again, so close keys share most of the descent.
+	 * Otherwise the keys are looked up in groups which go down the tree in lockstep: while the node needed by one lookup
+	 * is being fetched from memory (it is prefetched as soon as it is known), the other lookups of the group go on.
+	 */
+	template <class ForwardIt, class OutputIt>
+	OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const;
+	/**
+	 * @brief Returns an iterator to the first node whose key is not lower than key.
+	 * @param key The key to be compared.
+	 * @return Iterator The iterator to the node, end() if all the keys are lower.
+	 */
+	Iterator lower_bound(const TK& key) const;
+	/**
+	 * @brief Returns an iterator to the first node whose key is greater than key.
+	 * @param key The key to be compared.
+	 * @return Iterator The iterator to the node, end() if no key is greater.
+	 */
+	Iterator upper_bound(const TK& key) const;
+	/**
+	 * @brief Returns the range of nodes with a key equal to key: it is empty or it contains one node.
+	 * @param key The key to be compared.
+	 * @return std::pair<Iterator, Iterator> The lower_bound and the upper_bound of key.
+	 */
+	std::pair<Iterator, Iterator> equal_range(const TK& key) const { return {lower_bound(key), upper_bound(key)}; }
+	/**
+	 * @brief Returns the nodes with keys in [a, b), to be visited with a range-based for loop.
+	 * @param a The lowest key of the range.
+	 * @param b The key ending the range, not included.
+	 */
+	Range range(const TK& a, const TK& b) const;
+	/**
+	 * @brief Returns the number of keys lower than key, in O(log n).
+	 * @param key The key to be compared, it does not need to be in the tree.
+	 */
+	int rank(const TK& key) const;
+	/**
+	 * @brief Returns an iterator to the k-th smallest key, in O(log n).
+	 * @param k The position of the key in ascending order, starting from 0.
+	 * @return Iterator The iterator to the node, end() if k is not lower than the size of the tree.
+	 */
+	Iterator select(int k) const;
+	/**
+	 * @brief Returns the number of keys in [a, b), in O(log n).
+	 * @param a The lowest key of the range.
+	 * @param b The key ending the range, not included.
+	 */
+	int count_in_range(const TK& a, const TK& b) const { return comp(a, b) ? rank(b) - rank(a) : 0; }
+
+	/**
+	 * @brief Divides the tree in consecutive ranges of nodes, in ascending key order, to be visited independently.
+	 * @param pieces The approximate number of ranges wanted.
+	 * @return std::vector<Range> Ranges covering the whole tree, each one knowing its size.
+	 *
+	 * The tree is divided at subtree roots, using the node counts: a subtree small enough becomes a range (from its leftmost
+	 * node to its first right ancestor), a larger one is split into its left subtree, its root and its right subtree.
+	 * Neighbouring small pieces are merged, so the ranges have similar sizes. No key is compared.
+	 */
+	std::vector<Range> subranges(unsigned pieces) const;
+	/**
+	 * @brief Applies a function to every key-value pair, on several threads.
+	 * @param f Function taking a std::pair<const TK, TV>&, it may modify the value. It is called concurrently on different pairs.
+	 * @param threads Number of threads, by default the number of cores.
+	 *
+	 * The tree is divided with subranges in more ranges than threads; every thread takes the next range not yet visited,
+	 * so that a slow range does not keep the other threads idle. The first exception thrown by f is rethrown.
+	 */
+	template <class F>
+	void parallel_for_each(F f, unsigned threads = std::thread::hardware_concurrency()) const;
+	/**
+	 * @brief Combines all the key-value pairs into a single value, on several threads.
+	 * @param identity The neutral element of reduce.
+	 * @param map Function taking a const std::pair<const TK, TV>& and returning a T.
+	 * @param reduce Associative function combining two T.
+	 * @param threads Number of threads, by default the number of cores.
+	 * @return T The result of reduce applied to the mapped pairs in ascending key order.
+	 *
+	 * Every range is reduced on its own, then the partial results are combined in key order: reduce must be associative
+	 * but it does not need to be commutative (e.g. the concatenation of strings gives the keys in order).
+	 */
+	template <class T, class Map, class Reduce>
+	T parallel_reduce(T identity, Map map, Reduce reduce, unsigned threads = std::thread::hardware_concurrency()) const;
 	/**
 	 * @brief Balances the tree structure.
+	 *
+	 * The existing nodes are relinked in place in O(n) time, without copying keys or values and without allocating nodes.
 	 */
 	void balance();
+	/**
+	 * @brief Builds a read-only snapshot of the tree, optimized for lookups.
+	 * @return FrozenBST<TK,TV,Compare> A copy of all the key-value pairs, see BST_Frozen.h.
+	 *
+	 * Later modifications of the tree are not reflected in the snapshot.
+	 */
+	FrozenBST<TK, TV, Compare> freeze() const { return FrozenBST<TK, TV, Compare>(cbegin(), cend(), comp); }
+	/**
+	 * @brief Writes the key-value pairs to a file that load_mapped can map back without parsing. TK and TV must be trivially copyable.
+	 * @param path The file to be written.
+	 *
+	 * The pairs are written in the layout of a frozen snapshot, see FrozenBST::save.
+	 */
+	void save(const std::string& path) const { freeze().save(path); }
+	/**
+	 * @brief Maps a file written by save and returns a read-only snapshot serving find, iteration and operator[] from the mapping.
+	 * @param path The file to be mapped.
+	 * @return FrozenBST<TK,TV,Compare> The snapshot, see FrozenBST::load_mapped.
+	 */
+	static FrozenBST<TK, TV, Compare> load_mapped(const std::string& path) { return FrozenBST<TK, TV, Compare>::load_mapped(path); }
 	/**
 	 * @brief Used to begin an iteration on the binary search tree.
 	 * @return Iterator An iterator to the node with the lowest key. 
@@ -157,7 +621,7 @@ public:
 	 * @brief Used to end an iteration on the binary search tree.
 	 * @return Iterator An iterator to nullptr.
 	 */
-	Iterator end() { return Iterator{nullptr}; }
+	Iterator end() const { return Iterator{nullptr}; }
 	/**
 	 * @brief Used to begin an iteration on the binary search tree.
 	 * @return ConstIterator A constant iterator to the node with the lowest key.
@@ -185,14 +649,33 @@ public:
 	 * @brief Operator [] to access a node value in the tree.
 	 * @param key The key of the node which value should be accessed.
 	 * @return TV& The value of the accessed node.
+	 *
+	 * If the key is not present a node is inserted with a default constructed value.
+	 */
+	TV& operator[](const TK& key) { return tryEmplaceNode(key).first->keyvalue.second; }
+	/**
+	 * @brief Operator [] moving the key into the tree if a node has to be inserted.
 	 */
-	TV& operator[](const TK& key);
+	TV& operator[](TK&& key) { return tryEmplaceNode(std::move(key)).first->keyvalue.second; }
+	/**
+	 * @brief Heterogeneous operator [], available only with a transparent comparison object.
+	 * @param key A key of any type comparable with TK. A TK is built from it only if a node has to be inserted.
+	 */
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	TV& operator[](const K& key);
 	/**
 	 * @brief Constant implementation of operator [] to access a node value in the tree.
 	 * @param key The key of the node which value should be accessed.
 	 * @return TV& The value of the accessed node.
+	 *
+	 * Throws std::out_of_range if the key is not present.
 	 */
 	const TV& operator[](const TK& key) const;
+	/**
+	 * @brief Heterogeneous constant operator [], available only with a transparent comparison object.
+	 */
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	const TV& operator[](const K& key) const;
 	/**
 	 * @brief Operator << to print the binary search tree in ascending key order.
 	 * @param os The output stream to which the strings to be printed are appended.
@@ -200,7 +683,7 @@ public:
 	 * @return std::ostream& The output stream to which strings have been appended.
 	 */
 
-	friend std::ostream& operator<<(std::ostream& os, BST<TK,TV>& bst)
+	friend std::ostream& operator<<(std::ostream& os, BST& bst)
 	{	
 		return bst.printOrderedList(os);
 	}
@@ -0,0 +1,622 @@
+/**
+ * @file BST_BTree.h
+ * @author Francesca Cairoli
+ * @date 17 June 2019
+ * @brief Header for the BTree class, an ordered map storing many keys per node for small keys such as int and double.
+ */
+
+#include <algorithm> // needed for std::move_backward
+#include <cstddef> // needed for std::size_t
+#include <cstdint> // needed for std::uint16_t
+#include <functional> // needed for std::less
+#include <iostream> // needed for the << operator
+#include <memory> // needed for std::unique_ptr
+#include <stdexcept> // needed for std::out_of_range
+#include <utility> // needed for std::pair
+#include <vector>
+
+#ifndef BST_BTREE_H__
+#define BST_BTREE_H__
+
+/**
+ * @brief Default fanout of BTree: the keys of a node fill a few cache lines.
+ * @tparam TK Type of the keys.
+ */
+template <class TK>
+struct BTreeFanout
+{
+	/** Size of a cache line in bytes. */
+	static const std::size_t cache_line = 64;
+	/** Number of cache lines filled by the keys of a node. */
+	static const std::size_t lines = 4;
+	/** Maximum number of keys in a node: 64 for int, 32 for double, never less than 4. */
+	static const std::size_t value = lines * cache_line / sizeof(TK) < 4 ? 4 : lines * cache_line / sizeof(TK);
+};
+
+/**
+ * @brief Ordered map keeping up to Fanout keys per node in contiguous arrays (a B+ tree).
+ * @tparam TK Type of the keys, default constructible and assignable.
+ * @tparam TV Type of the values, default constructible and assignable.
+ * @tparam Fanout Maximum number of keys in a node, by default chosen from sizeof(TK) and the cache line size.
+ * @tparam Compare Comparison object ordering the keys.
+ *
+ * A BST node keeps one key next to three pointers and a value, so with int or double keys most of every cache line read
+ * during a lookup holds pointers. Here the inner nodes hold only keys and child pointers, the values are kept in the
+ * leaves, next to their keys, and the leaves are linked in key order for the iteration. The tree is always balanced: all
+ * the leaves are at the same depth, there is nothing like BST::balance to call.
+ *
+ * The search inside a node is a binary search whose steps depend only on the number of keys, not on the comparisons:
+ * the compiler turns each step into a conditional move, so a lookup does not mispredict branches. Keys and values are
+ * meant to be small types that copy without throwing.
+ */
+template <class TK,class TV,std::size_t Fanout = BTreeFanout<TK>::value,class Compare = std::less<TK>>
+class BTree
+{
+	static_assert(Fanout >= 3 && Fanout < 65536, "The fanout must be between 3 and 65535.");
+
+public:
+	/**
+	 * @brief An iterator visiting the tree in ascending key order.
+	 */
+	class Iterator;
+	/**
+	 * @brief A constant iterator visiting the tree in ascending key order.
+	 */
+	class ConstIterator;
+
+private:
+	/**
+	 * @brief The part shared by leaves and inner nodes: the sorted keys.
+	 */
+	struct Node
+	{
+		/** Number of keys in use. */
+		std::uint16_t count = 0;
+		/** The keys, in ascending order. */
+		TK keys[Fanout];
+	};
+	/**
+	 * @brief A leaf: the keys with their values, and the next leaf in key order.
+	 */
+	struct Leaf : Node
+	{
+		/** values[i] is the value of keys[i]. */
+		TV values[Fanout];
+		/** The leaf holding the following keys, nullptr for the last one. */
+		Leaf* next = nullptr;
+	};
+	/**
+	 * @brief An inner node: children[i] holds the keys lower than keys[i] and not lower than keys[i-1].
+	 */
+	struct Inner : Node
+	{
+		/** The count+1 subtrees. */
+		Node* children[Fanout + 1];
+	};
+
+	/** Upper bound of the number of levels: every inner node has at least two children. */
+	static const std::size_t max_levels = 64;
+
+	/** The root, a leaf if levels is 1. */
+	Node* root = nullptr;
+	/** The leaf holding the lowest keys. */
+	Leaf* first = nullptr;
+	/** Number of levels, 0 for an empty tree. All the leaves are on the last one. */
+	std::size_t levels = 0;
+	/** Number of elements. */
+	std::size_t n = 0;
+	/** Comparison object ordering the keys. */
+	Compare comp;
+
+	/**
+	 * @brief Returns the position of key among the keys of node, without branching on the comparisons.
+	 * @tparam Upper If true the position of the first key greater than key, otherwise of the first key not lower than key.
+	 * @param node The node to be searched.
+	 * @param key The key to be searched.
+	 *
+	 * Every step halves the candidates, taking the upper half when the middle key is before key: the number of steps is
+	 * fixed by the count of the node, and the choice is an addition instead of a jump.
+	 */
+	template <bool Upper>
+	std::size_t position(const Node* node, const TK& key) const noexcept
+	{
+		const TK* base = node->keys;
+		std::size_t len = node->count;
+		if(!len) return 0;
+		while(len > 1){
+			const std::size_t half = len / 2;
+			base += half * std::size_t(Upper ? !comp(key, base[half]) : comp(base[half], key));
+			len -= half;
+		}
+		return std::size_t(base - node->keys) + std::size_t(Upper ? !comp(key, *base) : comp(*base, key));
+	}
+
+	/**
+	 * @brief Returns the leaf in which key is or should be inserted.
+	 */
+	Leaf* findLeaf(const TK& key) const noexcept
+	{
+		Node* node = root;
+		for(std::size_t l = 1; l < levels; ++l)
+			node = static_cast<Inner*>(node)->children[position<true>(node, key)];
+		return static_cast<Leaf*>(node);
+	}
+
+	/**
+	 * @brief Inserts key with a default constructed value in position i of a leaf that is not full.
+	 */
+	static void insertAt(Leaf* leaf, std::size_t i, const TK& key)
+	{
+		std::move_backward(leaf->keys + i, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+		std::move_backward(leaf->values + i, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+		leaf->keys[i] = key;
+		leaf->values[i] = TV{};
+		++leaf->count;
+	}
+
+	/**
+	 * @brief Inserts separator and, after it, the child right in position i of an inner node that is not full.
+	 */
+	static void insertChild(Inner* in, std::size_t i, TK& separator, Node* right)
+	{
+		std::move_backward(in->keys + i, in->keys + in->count, in->keys + in->count + 1);
+		std::move_backward(in->children + i + 1, in->children + in->count + 1, in->children + in->count + 2);
+		in->keys[i] = std::move(separator);
+		in->children[i + 1] = right;
+		++in->count;
+	}
+
+	/**
+	 * @brief Splits a full inner node while inserting separator and right in position i.
+	 * @param in The full node, it keeps the lower half.
+	 * @param i Where separator would be inserted.
+	 * @param separator The key to be inserted, replaced by the key moving up to the parent.
+	 * @param right The child to be inserted after separator, replaced by sibling.
+	 * @param sibling An empty node receiving the upper half.
+	 */
+	static void splitInner(Inner* in, std::size_t i, TK& separator, Node*& right, Inner* sibling);
+
+	/**
+	 * @brief Finds key or inserts it with a default constructed value.
+	 * @return std::pair<Iterator, bool> The element of key, and true if it was inserted.
+	 *
+	 * The path from the root is remembered; if the leaf is full it is split, and so are its full ancestors. The new
+	 * nodes are all allocated before the tree is modified, so a failed allocation leaves the tree unchanged.
+	 */
+	std::pair<Iterator, bool> tryInsert(const TK& key);
+
+	/**
+	 * @brief Returns a copy of the subtree of s, whose root is on level level counting from the leaves (1).
+	 * @param last The last leaf copied so far, the copied leaves are linked after it.
+	 */
+	Node* cloneNode(const Node* s, std::size_t level, Leaf*& last);
+
+	/**
+	 * @brief Frees the subtree of node, whose root is on level level counting from the leaves (1).
+	 */
+	static void destroyNode(Node* node, std::size_t level) noexcept;
+
+public:
+	/**
+	 * @brief Builds an empty tree.
+	 */
+	BTree() {}
+	/**
+	 * @brief Copy constructor, the copy has the same nodes as bt.
+	 */
+	BTree(const BTree& bt);
+	/**
+	 * @brief Move constructor, bt is left empty.
+	 */
+	BTree(BTree&& bt) noexcept : root{bt.root}, first{bt.first}, levels{bt.levels}, n{bt.n}, comp{std::move(bt.comp)}
+	{
+		bt.root = nullptr; bt.first = nullptr; bt.levels = 0; bt.n = 0;
+	}
+	/**
+	 * @brief Copy assignment.
+	 */
+	BTree& operator=(const BTree& bt)
+	{
+		if(this != &bt){
+			BTree tmp{bt};
+			*this = std::move(tmp);
+		}
+		return *this;
+	}
+	/**
+	 * @brief Move assignment, bt is left empty.
+	 */
+	BTree& operator=(BTree&& bt) noexcept
+	{
+		if(this != &bt){
+			clear();
+			root = bt.root; first = bt.first; levels = bt.levels; n = bt.n; comp = std::move(bt.comp);
+			bt.root = nullptr; bt.first = nullptr; bt.levels = 0; bt.n = 0;
+		}
+		return *this;
+	}
+	/**
+	 * @brief Destructor, frees all the nodes.
+	 */
+	~BTree() { clear(); }
+
+	/**
+	 * @brief Return the number of elements in the tree.
+	 */
+	std::size_t getSize() const noexcept { return n; }
+	/**
+	 * @brief Return the number of levels of the tree, 0 if it is empty.
+	 */
+	std::size_t getHeight() const noexcept { return levels; }
+
+	/**
+	 * @brief Inserts a key-value pair, replacing the value if the key is already present.
+	 * @param kv The pair to be inserted.
+	 */
+	void insert(const std::pair<TK, TV>& kv) { *tryInsert(kv.first).first.valuePtr() = kv.second; }
+	/**
+	 * @brief Same as insert, moving the value into the tree.
+	 */
+	void insert(std::pair<TK, TV>&& kv) { *tryInsert(kv.first).first.valuePtr() = std::move(kv.second); }
+
+	/**
+	 * @brief Removes all the elements.
+	 */
+	void clear() noexcept
+	{
+		if(root) destroyNode(root, levels);
+		root = nullptr; first = nullptr; levels = 0; n = 0;
+	}
+
+	/**
+	 * @brief Method used to find a key inside the tree.
+	 * @param key The key to be found.
+	 * @return Iterator An iterator to the element if the key was found, otherwise end().
+	 */
+	Iterator find(const TK& key) const noexcept;
+
+	/**
+	 * @brief Used to begin an iteration on the tree.
+	 * @return Iterator An iterator to the lowest key.
+	 */
+	Iterator begin() noexcept;
+	/**
+	 * @brief Used to end an iteration on the tree.
+	 */
+	Iterator end() const noexcept;
+	/**
+	 * @brief Used to begin a constant iteration on the tree.
+	 */
+	ConstIterator cbegin() const noexcept;
+	/**
+	 * @brief Used to end a constant iteration on the tree.
+	 */
+	ConstIterator cend() const noexcept;
+	/**
+	 * @brief Same as cbegin, for constant trees.
+	 */
+	ConstIterator begin() const noexcept { return cbegin(); }
+
+	/**
+	 * @brief Operator [] to access the value of a key.
+	 * @param key The key whose value should be accessed.
+	 * @return TV& The value associated to the key.
+	 *
+	 * If the key is not present it is inserted with a default constructed value.
+	 */
+	TV& operator[](const TK& key) { return *tryInsert(key).first.valuePtr(); }
+	/**
+	 * @brief Constant implementation of operator [].
+	 *
+	 * Throws std::out_of_range if the key is not present.
+	 */
+	const TV& operator[](const TK& key) const;
+
+	/**
+	 * @brief Operator << to print the tree in ascending key order.
+	 * @param os The output stream to which the strings to be printed are appended.
+	 * @param bt The tree to be printed.
+	 * @return std::ostream& The output stream to which strings have been appended.
+	 */
+	friend std::ostream& operator<<(std::ostream& os, const BTree& bt)
+	{
+		if(!bt.n)
+			os << "The tree is empty!" << std::endl;
+		for(ConstIterator it = bt.cbegin(); it != bt.cend(); ++it)
+			os << it.key() << ": " << it.value() << std::endl;
+		return os;
+	}
+};
+
+/**
+ * @brief Iterator of BTree: a leaf and a position in it, a null leaf being the end.
+ */
+template <class TK,class TV,std::size_t Fanout,class Compare>
+class BTree<TK, TV, Fanout, Compare>::Iterator
+{
+	friend class BTree;
+
+protected:
+	/** The leaf of the current element. */
+	Leaf* _leaf;
+	/** The position of the current element in the leaf. */
+	std::size_t _i;
+
+	/**
+	 * @brief Returns a pointer to the value of the current element.
+	 */
+	TV* valuePtr() const noexcept { return _leaf->values + _i; }
+
+public:
+	/**
+	 * @brief Construct an iterator on element i of leaf.
+	 * @param leaf The leaf, nullptr for the end.
+	 * @param i The position in the leaf.
+	 */
+	Iterator(Leaf* leaf, std::size_t i) noexcept : _leaf{leaf}, _i{i} {}
+	/**
+	 * @brief Returns the key of the current element.
+	 */
+	const TK& key() const noexcept { return _leaf->keys[_i]; }
+	/**
+	 * @brief Returns the value of the current element.
+	 */
+	TV& value() const noexcept { return _leaf->values[_i]; }
+	/**
+	 * @brief Operator for deferencing the iterator.
+	 * @return std::pair<const TK&, TV&> The key and the value of the current element.
+	 */
+	std::pair<const TK&, TV&> operator*() const noexcept { return {key(), value()}; }
+	/**
+	 * @brief Operator ++it to advance the iterator to the next key, moving to the next leaf after the last key of a leaf.
+	 */
+	Iterator& operator++() noexcept
+	{
+		if(++_i == _leaf->count){
+			_leaf = _leaf->next;
+			_i = 0;
+		}
+		return *this;
+	}
+	/**
+	 * @brief Operator it++ to advance the iterator to the next key.
+	 */
+	Iterator operator++(int) noexcept
+	{
+		Iterator it{*this};
+		++(*this);
+		return it;
+	}
+	/**
+	 * @brief Operator == to check for iterators equality.
+	 */
+	bool operator==(const Iterator& it) const noexcept { return _leaf == it._leaf && _i == it._i; }
+	/**
+	 * @brief Operator != to check for iterators inequality.
+	 */
+	bool operator!=(const Iterator& it) const noexcept { return !(*this == it); }
+};
+
+/**
+ * @brief A constant iterator of BTree. The only difference with a normal iterator is that the values cannot be modified.
+ */
+template <class TK,class TV,std::size_t Fanout,class Compare>
+class BTree<TK, TV, Fanout, Compare>::ConstIterator : public BTree<TK, TV, Fanout, Compare>::Iterator
+{
+	/** Alias to make the notation easier */
+	using Iterator = BTree<TK, TV, Fanout, Compare>::Iterator;
+
+public:
+	/** Uses the same method of the base class. */
+	using Iterator::Iterator;
+	/**
+	 * @brief Returns the value of the current element.
+	 */
+	const TV& value() const noexcept { return Iterator::value(); }
+	/**
+	 * @brief Operator for deferencing the iterator.
+	 * @return std::pair<const TK&, const TV&> The key and the value of the current element.
+	 */
+	std::pair<const TK&, const TV&> operator*() const noexcept { return {this->key(), value()}; }
+};
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+void BTree<TK, TV, Fanout, Compare>::splitInner(Inner* in, std::size_t i, TK& separator, Node*& right, Inner* sibling)
+{
+	// The node would hold Fanout+1 keys and Fanout+2 children: the lower m keys stay, key m moves up, the others move
+	// to the sibling. keyAt and childAt read that sequence without building it.
+	const std::size_t m = Fanout / 2;
+	auto keyAt = [&](std::size_t j) -> TK& { return j < i ? in->keys[j] : j == i ? separator : in->keys[j-1]; };
+	auto childAt = [&](std::size_t j) { return j <= i ? in->children[j] : j == i + 1 ? right : in->children[j-1]; };
+	for(std::size_t j = m + 1; j <= Fanout; ++j)
+		sibling->keys[j-m-1] = std::move(keyAt(j));
+	for(std::size_t j = m + 1; j <= Fanout + 1; ++j)
+		sibling->children[j-m-1] = childAt(j);
+	sibling->count = std::uint16_t(Fanout - m);
+	TK up = std::move(keyAt(m));
+	if(i < m){
+		std::move_backward(in->keys + i, in->keys + m - 1, in->keys + m);
+		std::move_backward(in->children + i + 1, in->children + m, in->children + m + 1);
+		in->keys[i] = std::move(separator);
+		in->children[i + 1] = right;
+	}
+	in->count = std::uint16_t(m);
+	separator = std::move(up);
+	right = sibling;
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+std::pair<typename BTree<TK, TV, Fanout, Compare>::Iterator, bool> BTree<TK, TV, Fanout, Compare>::tryInsert(const TK& key)
+{
+	if(!root){
+		first = new Leaf;
+		root = first;
+		levels = 1;
+	}
+	Inner* path[max_levels];
+	std::size_t slot[max_levels];
+	const std::size_t depth = levels - 1;
+	Node* node = root;
+	for(std::size_t l = 0; l < depth; ++l){
+		path[l] = static_cast<Inner*>(node);
+		slot[l] = position<true>(node, key);
+		node = path[l]->children[slot[l]];
+	}
+	Leaf* leaf = static_cast<Leaf*>(node);
+	const std::size_t i = position<false>(leaf, key);
+	if(i < leaf->count && !comp(key, leaf->keys[i]))
+		return {Iterator{leaf, i}, false};
+	if(leaf->count < Fanout){
+		insertAt(leaf, i, key);
+		++n;
+		return {Iterator{leaf, i}, true};
+	}
+
+	// The leaf is full: it is split, together with the full ancestors above it (and the root, if all are full).
+	std::size_t full = 0;
+	while(full < depth && path[depth-1-full]->count == Fanout) ++full;
+	std::unique_ptr<Leaf> sibling{new Leaf};
+	std::vector<std::unique_ptr<Inner>> spares;
+	for(std::size_t s = 0; s < full + (full == depth); ++s)
+		spares.emplace_back(new Inner);
+
+	// Keys inserted past the last one, or before the first one, fill the old leaf instead of leaving two half-empty leaves
+	const std::size_t keep = (!leaf->next && i == Fanout) ? Fanout : (leaf == first && i == 0) ? 1 : (Fanout + 1) / 2;
+	Leaf* s = sibling.release();
+	Iterator result{leaf, i};
+	if(i < keep){
+		std::move(leaf->keys + keep - 1, leaf->keys + Fanout, s->keys);
+		std::move(leaf->values + keep - 1, leaf->values + Fanout, s->values);
+		s->count = std::uint16_t(Fanout - keep + 1);
+		leaf->count = std::uint16_t(keep - 1);
+		insertAt(leaf, i, key);
+	} else {
+		std::move(leaf->keys + keep, leaf->keys + Fanout, s->keys);
+		std::move(leaf->values + keep, leaf->values + Fanout, s->values);
+		s->count = std::uint16_t(Fanout - keep);
+		leaf->count = std::uint16_t(keep);
+		insertAt(s, i - keep, key);
+		result = Iterator{s, i - keep};
+	}
+	s->next = leaf->next;
+	leaf->next = s;
+	++n;
+
+	TK separator = s->keys[0];
+	Node* right = s;
+	std::size_t next_spare = 0;
+	for(std::size_t l = depth; l-- > 0;){
+		if(path[l]->count < Fanout){
+			insertChild(path[l], slot[l], separator, right);
+			return {result, true};
+		}
+		splitInner(path[l], slot[l], separator, right, spares[next_spare++].release());
+	}
+	Inner* top = spares[next_spare].release();
+	top->keys[0] = std::move(separator);
+	top->children[0] = root;
+	top->children[1] = right;
+	top->count = 1;
+	root = top;
+	++levels;
+	return {result, true};
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+typename BTree<TK, TV, Fanout, Compare>::Node* BTree<TK, TV, Fanout, Compare>::cloneNode(const Node* s, std::size_t level, Leaf*& last)
+{
+	if(level == 1){
+		const Leaf* sl = static_cast<const Leaf*>(s);
+		std::unique_ptr<Leaf> l{new Leaf};
+		std::copy(sl->keys, sl->keys + sl->count, l->keys);
+		std::copy(sl->values, sl->values + sl->count, l->values);
+		l->count = sl->count;
+		if(last) last->next = l.get();
+		else first = l.get();
+		last = l.get();
+		return l.release();
+	}
+	const Inner* si = static_cast<const Inner*>(s);
+	std::unique_ptr<Inner> in{new Inner};
+	std::size_t done = 0;
+	try{
+		for(; done <= si->count; ++done)
+			in->children[done] = cloneNode(si->children[done], level - 1, last);
+	} catch(...){
+		for(std::size_t c = 0; c < done; ++c)
+			destroyNode(in->children[c], level - 1);
+		throw;
+	}
+	std::copy(si->keys, si->keys + si->count, in->keys);
+	in->count = si->count;
+	return in.release();
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+void BTree<TK, TV, Fanout, Compare>::destroyNode(Node* node, std::size_t level) noexcept
+{
+	if(level == 1){
+		delete static_cast<Leaf*>(node);
+		return;
+	}
+	Inner* in = static_cast<Inner*>(node);
+	for(std::size_t c = 0; c <= in->count; ++c)
+		destroyNode(in->children[c], level - 1);
+	delete in;
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+BTree<TK, TV, Fanout, Compare>::BTree(const BTree& bt) : comp{bt.comp}
+{
+	if(!bt.root) return;
+	Leaf* last = nullptr;
+	root = cloneNode(bt.root, bt.levels, last);
+	levels = bt.levels;
+	n = bt.n;
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+typename BTree<TK, TV, Fanout, Compare>::Iterator BTree<TK, TV, Fanout, Compare>::find(const TK& key) const noexcept
+{
+	if(!root) return end();
+	Leaf* leaf = findLeaf(key);
+	const std::size_t i = position<false>(leaf, key);
+	if(i < leaf->count && !comp(key, leaf->keys[i]))
+		return Iterator{leaf, i};
+	return end();
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+typename BTree<TK, TV, Fanout, Compare>::Iterator BTree<TK, TV, Fanout, Compare>::begin() noexcept
+{
+	return Iterator{n ? first : nullptr, 0};
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+typename BTree<TK, TV, Fanout, Compare>::Iterator BTree<TK, TV, Fanout, Compare>::end() const noexcept
+{
+	return Iterator{nullptr, 0};
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+typename BTree<TK, TV, Fanout, Compare>::ConstIterator BTree<TK, TV, Fanout, Compare>::cbegin() const noexcept
+{
+	return ConstIterator{n ? first : nullptr, 0};
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+typename BTree<TK, TV, Fanout, Compare>::ConstIterator BTree<TK, TV, Fanout, Compare>::cend() const noexcept
+{
+	return ConstIterator{nullptr, 0};
+}
+
+template <class TK,class TV,std::size_t Fanout,class Compare>
+const TV& BTree<TK, TV, Fanout, Compare>::operator[](const TK& key) const
+{
+	Iterator it{find(key)};
+	if(it == end())
+		throw std::out_of_range{"The key is not present in the tree."};
+	return it.value();
+}
+
+#endif //BST_BTREE_H__
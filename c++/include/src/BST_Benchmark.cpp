@@ -0,0 +1,309 @@
+/**
+ * @file BST_Benchmark.cpp
+ * @author Francesca Cairoli
+ * @date 17 June 2019
+ * @brief Reproducible benchmark of the BST class against std::map and std::unordered_map.
+ *
+ * Every container is filled with exactly the same keys, produced by a seeded generator (uniform, Zipfian, sequential or
+ * reverse sorted), and measured phase by phase: insert, find, iterate, balance, copy and erase. Single operations are
+ * timed one by one, so that the latency percentiles (p50, p99, p999) can be reported next to the mean. Every measure is
+ * preceded by warm-up runs and repeated (the latencies include the cost of reading the clock, a few tens of
+ * nanoseconds, the same for all the containers); the results are written as JSON and CSV, one record per container, key
+ * distribution and phase, to be loaded directly by the notebooks in c++/tests.
+ *
+ * Usage: benchmark.o [n] [repetitions] [warmup] [seed] [output prefix]
+ */
+
+#include "BST.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+using bench_clock = chrono::steady_clock;
+
+volatile long long sink; // keeps the compiler from dropping the measured operations
+
+// Key generators: the same seed always gives the same keys.
+
+/**
+ * @brief Returns n keys drawn uniformly from [0, 2^31).
+ */
+vector<int> uniform_keys(size_t n, unsigned seed){
+	mt19937_64 gen{seed};
+	uniform_int_distribution<int> dist{0, 2147483647};
+	vector<int> keys(n);
+	for(auto& k : keys) k = dist(gen);
+	return keys;
+}
+
+/**
+ * @brief Returns n keys following a Zipf law of exponent s over n distinct keys: few keys are drawn very often.
+ *
+ * The distinct keys are spread over [0, 2^31), so that the most frequent keys are not neighbours in the tree.
+ */
+vector<int> zipf_keys(size_t n, unsigned seed, double s = 0.99){
+	vector<int> universe = uniform_keys(n, seed ^ 0x5bd1e995u);
+	vector<double> cdf(n);
+	double total = 0;
+	for(size_t i = 0; i < n; ++i){
+		total += 1.0 / pow(double(i + 1), s);
+		cdf[i] = total;
+	}
+	mt19937_64 gen{seed};
+	uniform_real_distribution<double> dist{0.0, total};
+	vector<int> keys(n);
+	for(auto& k : keys){
+		size_t rank = lower_bound(cdf.begin(), cdf.end(), dist(gen)) - cdf.begin();
+		k = universe[min(rank, n - 1)];
+	}
+	return keys;
+}
+
+/**
+ * @brief Returns the keys 0, 1, ..., n-1.
+ */
+vector<int> sequential_keys(size_t n){
+	vector<int> keys(n);
+	for(size_t i = 0; i < n; ++i) keys[i] = int(i);
+	return keys;
+}
+
+/**
+ * @brief Returns the keys n-1, n-2, ..., 0.
+ */
+vector<int> reverse_keys(size_t n){
+	vector<int> keys = sequential_keys(n);
+	reverse(keys.begin(), keys.end());
+	return keys;
+}
+
+/**
+ * @brief The inputs of a run: the keys to be inserted, the keys to be looked up and the keys to be erased.
+ */
+struct Workload{
+	string distribution;
+	vector<int> inserts;
+	vector<int> queries;
+	vector<int> erases;
+};
+
+/**
+ * @brief Builds the workload of a distribution. Queries and erases are drawn from the inserted keys, in random order.
+ */
+Workload make_workload(const string& distribution, size_t n, unsigned seed){
+	Workload w;
+	w.distribution = distribution;
+	if(distribution == "uniform") w.inserts = uniform_keys(n, seed);
+	else if(distribution == "zipf") w.inserts = zipf_keys(n, seed);
+	else if(distribution == "sequential") w.inserts = sequential_keys(n);
+	else w.inserts = reverse_keys(n);
+
+	mt19937_64 gen{seed + 1};
+	if(distribution == "zipf")
+		w.queries = zipf_keys(n, seed); // the lookups are skewed as the insertions
+	else{
+		w.queries = w.inserts;
+		shuffle(w.queries.begin(), w.queries.end(), gen);
+	}
+	w.erases = w.inserts;
+	shuffle(w.erases.begin(), w.erases.end(), gen);
+	return w;
+}
+
+// Statistics
+
+/**
+ * @brief One line of the results: the latencies of a phase, in nanoseconds.
+ */
+struct Record{
+	string container;
+	string distribution;
+	string phase;
+	size_t n;
+	size_t samples;
+	double mean;
+	double p50;
+	double p99;
+	double p999;
+};
+
+/**
+ * @brief Returns the percentile q (between 0 and 1) of sorted samples, with the nearest-rank method.
+ */
+double percentile(const vector<double>& sorted, double q){
+	if(sorted.empty()) return 0;
+	size_t rank = size_t(ceil(q * double(sorted.size())));
+	return sorted[rank ? rank - 1 : 0];
+}
+
+/**
+ * @brief Summarizes the samples of a phase in a record.
+ */
+Record summarize(const string& container, const Workload& w, const string& phase, vector<double> samples){
+	sort(samples.begin(), samples.end());
+	double total = 0;
+	for(double x : samples) total += x;
+	return Record{container, w.distribution, phase, w.inserts.size(), samples.size(),
+	              samples.empty() ? 0 : total / double(samples.size()),
+	              percentile(samples, 0.5), percentile(samples, 0.99), percentile(samples, 0.999)};
+}
+
+/**
+ * @brief Returns the nanoseconds elapsed since start.
+ */
+double elapsed(bench_clock::time_point start){
+	return double(chrono::duration_cast<chrono::nanoseconds>(bench_clock::now() - start).count());
+}
+
+// Uniform access to the containers.
+
+int key_of(const pair<const int, int>& kv){ return kv.first; }
+template<class N>
+int key_of(const N* node){ return node->keyvalue.first; }
+
+template<class T>
+auto balance_of(T& c, int) -> decltype(c.balance(), bool()) { c.balance(); return true; }
+template<class T>
+bool balance_of(T&, long){ return false; } // std::map and std::unordered_map have nothing to balance
+
+/**
+ * @brief Runs all the phases on a container type, with warm-up and repetitions.
+ * @param name Name of the container in the results.
+ * @param w The workload, the same for all the containers.
+ * @param reps Number of measured repetitions.
+ * @param warmup Number of repetitions run before measuring.
+ * @param records Where the results are appended.
+ *
+ * Insert, find and erase are timed operation by operation; iterate, balance and copy, which work on the whole
+ * container, are timed once per repetition and reported per element.
+ */
+template<class T>
+void run_phases(const string& name, const Workload& w, int reps, int warmup, vector<Record>& records){
+	const size_t n = w.inserts.size();
+	vector<double> insert_t, find_t, iterate_t, balance_t, copy_t, erase_t;
+	bool balanced = false;
+	for(int r = -warmup; r < reps; ++r){
+		const bool keep = r >= 0;
+		T c;
+		for(int k : w.inserts){
+			auto start = bench_clock::now();
+			c.insert(pair<int, int>{k, k});
+			double t = elapsed(start);
+			if(keep) insert_t.push_back(t);
+		}
+
+		long long found = 0;
+		for(int k : w.queries){
+			auto start = bench_clock::now();
+			found += (c.find(k) != c.end());
+			double t = elapsed(start);
+			if(keep) find_t.push_back(t);
+		}
+
+		long long sum = 0;
+		auto start = bench_clock::now();
+		for(auto&& x : c) sum += key_of(x);
+		double t = elapsed(start) / double(n);
+		if(keep) iterate_t.push_back(t);
+
+		start = bench_clock::now();
+		balanced = balance_of(c, 0);
+		t = elapsed(start) / double(n);
+		if(keep && balanced) balance_t.push_back(t);
+
+		start = bench_clock::now();
+		{
+			T copy{c};
+			sum += static_cast<long long>(copy.size());
+		}
+		t = elapsed(start) / double(n); // the destruction of the copy is measured too
+		if(keep) copy_t.push_back(t);
+
+		for(int k : w.erases){
+			start = bench_clock::now();
+			found += c.erase(k);
+			t = elapsed(start);
+			if(keep) erase_t.push_back(t);
+		}
+		sink = found + sum;
+	}
+	records.push_back(summarize(name, w, "insert", move(insert_t)));
+	records.push_back(summarize(name, w, "find", move(find_t)));
+	records.push_back(summarize(name, w, "iterate", move(iterate_t)));
+	if(balanced) records.push_back(summarize(name, w, "balance", move(balance_t)));
+	records.push_back(summarize(name, w, "copy", move(copy_t)));
+	records.push_back(summarize(name, w, "erase", move(erase_t)));
+	cout << name << " (" << w.distribution << ") done" << endl;
+}
+
+/**
+ * @brief Adapter giving BST the names used by the standard containers for the phases.
+ */
+template<class Tree>
+struct BSTAdapter : Tree{
+	using Tree::Tree;
+	size_t size() const { return size_t(this->getSize()); }
+};
+
+// Output
+
+void write_csv(const string& path, const vector<Record>& records){
+	ofstream out{path};
+	out << "container,distribution,phase,n,samples,mean_ns,p50_ns,p99_ns,p999_ns" << endl;
+	for(const Record& r : records)
+		out << r.container << "," << r.distribution << "," << r.phase << "," << r.n << "," << r.samples << ","
+		    << r.mean << "," << r.p50 << "," << r.p99 << "," << r.p999 << endl;
+}
+
+void write_json(const string& path, const vector<Record>& records, unsigned seed, int reps, int warmup){
+	ofstream out{path};
+	out << "{" << endl;
+	out << "  \"seed\": " << seed << ", \"repetitions\": " << reps << ", \"warmup\": " << warmup << "," << endl;
+	out << "  \"results\": [" << endl;
+	for(size_t i = 0; i < records.size(); ++i){
+		const Record& r = records[i];
+		out << "    {\"container\": \"" << r.container << "\", \"distribution\": \"" << r.distribution
+		    << "\", \"phase\": \"" << r.phase << "\", \"n\": " << r.n << ", \"samples\": " << r.samples
+		    << ", \"mean_ns\": " << r.mean << ", \"p50_ns\": " << r.p50 << ", \"p99_ns\": " << r.p99
+		    << ", \"p999_ns\": " << r.p999 << "}" << (i + 1 < records.size() ? "," : "") << endl;
+	}
+	out << "  ]" << endl << "}" << endl;
+}
+
+int main(int argc, char** argv){
+	size_t n = argc > 1 ? size_t(atol(argv[1])) : 100000;
+	int reps = argc > 2 ? atoi(argv[2]) : 5;
+	int warmup = argc > 3 ? atoi(argv[3]) : 1;
+	unsigned seed = argc > 4 ? unsigned(atol(argv[4])) : 42;
+	string prefix = argc > 5 ? argv[5] : "benchmark_results";
+
+	// The plain BST degenerates into a list with sorted keys: its quadratic insertion is measured only on small inputs.
+	const size_t max_unbalanced_sorted = 20000;
+
+	vector<Record> records;
+	for(const string distribution : {"uniform", "zipf", "sequential", "reverse"}){
+		Workload w = make_workload(distribution, n, seed);
+		const bool sorted = distribution == "sequential" || distribution == "reverse";
+		if(!sorted || n <= max_unbalanced_sorted)
+			run_phases<BSTAdapter<BST<int,int>>>("BST", w, reps, warmup, records);
+		run_phases<BSTAdapter<BST<int,int,AVLBalancing>>>("BST_AVL", w, reps, warmup, records);
+		run_phases<BSTAdapter<BST<int,int,AVLBalancing,ArenaAllocation>>>("BST_AVL_arena", w, reps, warmup, records);
+		run_phases<map<int,int>>("map", w, reps, warmup, records);
+		run_phases<unordered_map<int,int>>("unordered_map", w, reps, warmup, records);
+	}
+	write_csv(prefix + ".csv", records);
+	write_json(prefix + ".json", records, seed, reps, warmup);
+	cout << "Results written to " << prefix << ".csv and " << prefix << ".json" << endl;
+	return 0;
+}
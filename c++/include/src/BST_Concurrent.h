@@ -0,0 +1,277 @@
+/**
+ * @file BST_Concurrent.h
+ * @author Francesca Cairoli
+ * @date 17 June 2019
+ * @brief Header for the ConcurrentBST class, a binary search tree that can be read by many threads while one thread writes it.
+ */
+
+#include "BST.h"
+#include <atomic>
+#include <cstddef> // needed for std::size_t
+#include <functional> // needed for std::hash
+#include <mutex>
+#include <thread>
+
+#ifndef BST_CONCURRENT_H__
+#define BST_CONCURRENT_H__
+
+/**
+ * @brief A binary search tree supporting lock-free concurrent readers and one writer at a time.
+ * @tparam TK Type of the keys.
+ * @tparam TV Type of the values.
+ * @tparam Policies Optional policies forwarded to BST (balancing, allocation, ...).
+ *
+ * The class implements the Left-Right technique: two identical BST instances are kept, readers always use the one that
+ * the writer is not touching. The writer modifies the idle instance, redirects the new readers to it, waits until the
+ * readers still using the old instance are gone and then applies the same modification to the old instance.
+ * Readers never take a lock and never see a node being linked, rotated or relinked (parent pointers included), so they
+ * can iterate with the usual BST iterators. The price is twice the memory and every modification applied twice.
+ * A thread must release its ReadGuard before modifying the tree, or it deadlocks waiting for itself.
+ */
+template <class TK,class TV,class... Policies>
+class ConcurrentBST
+{
+public:
+	/** The tree type of the two instances. */
+	using Tree = BST<TK, TV, Policies...>;
+
+	/**
+	 * @brief A read access to the tree. While the guard is alive the tree it refers to is not modified.
+	 */
+	class ReadGuard;
+
+private:
+	/**
+	 * @brief Counts the readers currently using a tree instance.
+	 *
+	 * The counter is split in cache-line sized stripes, each reader thread always uses the same stripe,
+	 * so readers running on different cores do not fight over the same cache line.
+	 */
+	class ReadIndicator
+	{
+		/** A counter alone in its cache line. */
+		struct alignas(64) Stripe
+		{
+			/** Number of readers arrived on this stripe and not departed yet. */
+			std::atomic<long> readers;
+			/** Builds an empty stripe. */
+			Stripe() noexcept : readers{0} {}
+		};
+		/** Number of stripes. */
+		static const std::size_t stripes = 64;
+		/** The stripes of the counter. */
+		Stripe counters[stripes];
+
+	public:
+		/**
+		 * @brief Returns the stripe used by the calling thread.
+		 */
+		static std::size_t stripe() noexcept
+		{
+			static thread_local std::size_t s = std::hash<std::thread::id>{}(std::this_thread::get_id()) % stripes;
+			return s;
+		}
+		/**
+		 * @brief Registers a reader on stripe s.
+		 */
+		void arrive(std::size_t s) noexcept { counters[s].readers.fetch_add(1); }
+		/**
+		 * @brief Unregisters a reader from stripe s.
+		 */
+		void depart(std::size_t s) noexcept { counters[s].readers.fetch_sub(1); }
+		/**
+		 * @brief Checks whether there is no reader left.
+		 */
+		bool isEmpty() const noexcept
+		{
+			for(std::size_t i = 0; i < stripes; ++i)
+				if(counters[i].readers.load() != 0) return false;
+			return true;
+		}
+	};
+
+	/** The two instances of the tree. */
+	Tree trees[2];
+	/** Index of the instance that new readers must use. */
+	std::atomic<int> leftRight;
+	/** Index of the read indicator on which new readers arrive. */
+	std::atomic<int> versionIndex;
+	/** The two read indicators. */
+	mutable ReadIndicator indicators[2];
+	/** Serializes the writers, readers never take it. */
+	std::mutex writer;
+	/** True if a modification failed on the instance not used by new readers, which may then differ from the other one. */
+	bool stale = false;
+
+	/**
+	 * @brief Rebuilds the instance not used by new readers as a copy of the other one. Called with the writer lock held.
+	 *
+	 * If the copy throws, the instance stays stale and the next modification tries again before anything else.
+	 */
+	void resync()
+	{
+		const int lr = leftRight.load();
+		stale = true;
+		trees[1-lr] = trees[lr];
+		stale = false;
+	}
+
+	/**
+	 * @brief Waits until all the readers of indicator i are gone.
+	 * @param i The read indicator to be drained.
+	 */
+	void drain(int i) const
+	{
+		while(!indicators[i].isEmpty())
+			std::this_thread::yield();
+	}
+
+public:
+	/**
+	 * @brief Default constructor, both instances are empty.
+	 */
+	ConcurrentBST() : leftRight{0}, versionIndex{0} {}
+
+	/**
+	 * @brief The class cannot be copied: readers hold references to its internals.
+	 */
+	ConcurrentBST(const ConcurrentBST&) = delete;
+	/**
+	 * @brief The class cannot be copied: readers hold references to its internals.
+	 */
+	ConcurrentBST& operator=(const ConcurrentBST&) = delete;
+
+	/**
+	 * @brief Starts a read access. No lock is taken.
+	 * @return ReadGuard The guard giving access to a constant tree until it goes out of scope.
+	 */
+	ReadGuard read() const noexcept { return ReadGuard{*this}; }
+
+	/**
+	 * @brief Looks up a key, copying its value.
+	 * @param key The key to be found.
+	 * @param value Where the value is copied if the key is present.
+	 * @return bool True if the key was found.
+	 */
+	bool find(const TK& key, TV& value) const
+	{
+		ReadGuard g{read()};
+		auto it = g->find(key);
+		if(it == g->end()) return false;
+		value = (*it)->keyvalue.second;
+		return true;
+	}
+
+	/**
+	 * @brief Applies a modification to the tree. The modification is applied once to each instance, so it must be deterministic.
+	 * @param f Function taking a Tree& and modifying it.
+	 *
+	 * If the first application throws, the readers have not seen it: the modified instance is rebuilt as a copy of the
+	 * other one and the exception is rethrown. If the second one throws, the modification is already visible: the second
+	 * instance is rebuilt as a copy of the first and modify returns normally. Either way the two instances stay equal; if
+	 * even the copy fails, the copy is tried again by the next modification.
+	 * A thread holding a ReadGuard must not call modify (nor insert, bulk_insert, balance or clear): the writer would wait
+	 * forever for that reader to leave.
+	 */
+	template <class F>
+	void modify(F f)
+	{
+		std::lock_guard<std::mutex> lock{writer};
+		if(stale) resync();
+		const int lr = leftRight.load();
+		try{
+			f(trees[1-lr]);
+		} catch(...){
+			try{ resync(); } catch(...){}
+			throw;
+		}
+		leftRight.store(1-lr); // new readers go to the modified instance
+
+		// wait for the readers that may still be using trees[lr]
+		const int prev = versionIndex.load();
+		const int next = 1-prev;
+		drain(next);
+		versionIndex.store(next);
+		drain(prev);
+
+		try{
+			f(trees[lr]);
+		} catch(...){
+			try{ resync(); } catch(...){}
+		}
+	}
+
+	/**
+	 * @brief Insert a new key,value pair, see BST::insert.
+	 * @param kv The key,value pair to be inserted.
+	 */
+	void insert(const std::pair<TK, TV>& kv) { modify([&kv](Tree& t){ t.insert(kv); }); }
+
+	/**
+	 * @brief Insert a range of key,value pairs, see BST::bulk_insert.
+	 * @param first Iterator to the first pair of the range, it must be a forward iterator since the range is read twice.
+	 * @param last Iterator past the last pair of the range.
+	 */
+	template <class ForwardIt>
+	void bulk_insert(ForwardIt first, ForwardIt last) { modify([&](Tree& t){ t.bulk_insert(first, last); }); }
+
+	/**
+	 * @brief Balances the tree, see BST::balance.
+	 */
+	void balance() { modify([](Tree& t){ t.balance(); }); }
+
+	/**
+	 * @brief Clears all the elements of the tree.
+	 */
+	void clear() { modify([](Tree& t){ t.clear(); }); }
+};
+
+/**
+ * @brief Read access to a ConcurrentBST, it behaves like a pointer to a constant BST.
+ *
+ * The iterators obtained through the guard must not be used after the guard is destroyed.
+ */
+template <class TK,class TV,class... Policies>
+class ConcurrentBST<TK, TV, Policies...>::ReadGuard
+{
+	/** The tree being read, nullptr once the guard has been moved. */
+	const ConcurrentBST* _c;
+	/** The read indicator on which the reader arrived. */
+	int _vi;
+	/** The stripe of the read indicator used by the reader. */
+	std::size_t _s;
+	/** The instance being read. */
+	const Tree* _t;
+
+public:
+	/**
+	 * @brief Registers the calling thread as a reader of c.
+	 * @param c The tree to be read.
+	 */
+	explicit ReadGuard(const ConcurrentBST& c) noexcept : _c{&c}, _vi{c.versionIndex.load()}, _s{ReadIndicator::stripe()}
+	{
+		_c->indicators[_vi].arrive(_s);
+		_t = &_c->trees[_c->leftRight.load()];
+	}
+	/**
+	 * @brief Move constructor, g no longer holds the read access.
+	 */
+	ReadGuard(ReadGuard&& g) noexcept : _c{g._c}, _vi{g._vi}, _s{g._s}, _t{g._t} { g._c = nullptr; }
+	ReadGuard(const ReadGuard&) = delete;
+	ReadGuard& operator=(const ReadGuard&) = delete;
+	/**
+	 * @brief Ends the read access.
+	 */
+	~ReadGuard() { if(_c) _c->indicators[_vi].depart(_s); }
+
+	/**
+	 * @brief Access to the tree.
+	 */
+	const Tree& operator*() const noexcept { return *_t; }
+	/**
+	 * @brief Access to the members of the tree.
+	 */
+	const Tree* operator->() const noexcept { return _t; }
+};
+
+#endif //BST_CONCURRENT_H__
@@ -0,0 +1,496 @@
+/**
+ * @file BST_Frozen.h
+ * @author Francesca Cairoli
+ * @date 17 June 2019
+ * @brief Header for the FrozenBST class, an immutable snapshot of a binary search tree laid out for fast lookups.
+ */
+
+#include <cstddef> // needed for std::size_t
+#include <cstdint> // needed for the fixed size fields of the file header
+#include <cstring> // needed for std::memcmp
+#include <functional> // needed for std::less
+#include <fstream> // needed for save
+#include <iostream> // needed for the << operator
+#include <memory> // needed for std::shared_ptr
+#include <stdexcept> // needed for std::out_of_range and std::runtime_error
+#include <string>
+#include <type_traits> // needed for std::is_trivially_copyable
+#include <utility> // needed for std::pair
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h> // needed for open
+#include <sys/mman.h> // needed for mmap
+#include <sys/stat.h> // needed for fstat
+#include <unistd.h> // needed for close
+#endif
+
+#ifndef BST_FROZEN_H__
+#define BST_FROZEN_H__
+
+/**
+ * @brief Read-only snapshot of a binary search tree, built by BST::freeze().
+ * @tparam TK Type of the keys.
+ * @tparam TV Type of the values.
+ * @tparam Compare Comparison object ordering the keys, the same used by the tree.
+ *
+ * The keys are stored in a single array in Eytzinger (breadth-first) order: the children of the element in position k
+ * (counting from 1) are in positions 2k and 2k+1. The first levels of the tree share a few cache lines, the lookup does not
+ * chase pointers and it is written without data-dependent branches, prefetching the cache line needed four levels below.
+ * The values are kept in a parallel array, so only the keys are touched while searching.
+ *
+ * With trivially copyable keys and values the two arrays can be written to a file with save and mapped back in memory
+ * with load_mapped: the loaded snapshot reads the mapped file directly, nothing is parsed, copied or allocated per element.
+ */
+template <class TK,class TV,class Compare = std::less<TK>>
+class FrozenBST
+{
+public:
+	/**
+	 * @brief A constant iterator visiting the snapshot in ascending key order.
+	 */
+	class ConstIterator;
+
+private:
+	/**
+	 * @brief Header of the files written by save. The numbers are written in the byte order of the machine.
+	 */
+	struct FileHeader
+	{
+		/** Identifies the file format. */
+		char magic[8];
+		/** Version of the format, see file_version. */
+		std::uint32_t version;
+		/** The number 0x01020304 as written by the machine that saved the file: it tells its byte order. */
+		std::uint32_t endianness;
+		/** sizeof(TK) on the machine that saved the file. */
+		std::uint32_t key_size;
+		/** sizeof(TV) on the machine that saved the file. */
+		std::uint32_t value_size;
+		/** Number of elements. */
+		std::uint64_t count;
+		/** Position of the keys in the file, in bytes. */
+		std::uint64_t keys_offset;
+		/** Position of the values in the file, in bytes. */
+		std::uint64_t values_offset;
+	};
+	/** Version of the file format written by save. */
+	static const std::uint32_t file_version = 1;
+	/** Alignment of the arrays in the file: a cache line, at least the alignment of any key or value. */
+	static const std::size_t file_alignment = 64;
+
+	/** Keys in Eytzinger order, the element k (counting from 1) is keys[k-1]. Empty for a mapped snapshot. */
+	std::vector<TK> keys;
+	/** Values, in the same order as the keys. Empty for a mapped snapshot. */
+	std::vector<TV> values;
+	/** The keys being used: the data of keys or the mapped file. */
+	const TK* key_base;
+	/** The values being used: the data of values or the mapped file. */
+	const TV* value_base;
+	/** Number of elements. */
+	std::size_t n;
+	/** The mapped file, unmapped when the last snapshot using it is destroyed. Empty if the snapshot owns its arrays. */
+	std::shared_ptr<const void> mapping;
+	/** Comparison object ordering the keys. */
+	Compare comp;
+
+	/**
+	 * @brief Points the bases to the owned arrays, after they have been built, copied or moved.
+	 */
+	void rebase() noexcept
+	{
+		if(mapping) return;
+		key_base = keys.data();
+		value_base = values.data();
+		n = keys.size();
+	}
+
+	/**
+	 * @brief Returns the position of the first multiple of file_alignment not lower than offset.
+	 */
+	static std::uint64_t aligned(std::uint64_t offset) noexcept
+	{
+		return (offset + file_alignment - 1) / file_alignment * file_alignment;
+	}
+
+	/**
+	 * @brief Goes up from position k until the first ancestor of which k is in the left subtree.
+	 * @param k Position in the implicit tree, counting from 1.
+	 * @return std::size_t The ancestor position, 0 if there is none.
+	 *
+	 * The trailing ones of k (right turns) are dropped together with one more bit (the left turn).
+	 */
+	static std::size_t firstrightancestor(std::size_t k) noexcept
+	{
+#if defined(__GNUC__)
+		return k >> __builtin_ffsll(static_cast<long long>(~k));
+#else
+		while(k & 1) k >>= 1;
+		return k >> 1;
+#endif
+	}
+
+	/**
+	 * @brief Returns the position of the first key that is not lower than key, 0 if all the keys are lower.
+	 * @param key The key to be searched.
+	 */
+	std::size_t lowerBound(const TK& key) const noexcept
+	{
+		const TK* base = key_base;
+		std::size_t k = 1;
+		while(k <= n){
+#if defined(__GNUC__)
+			// 16 positions below k are four levels down, the whole group fits in a few cache lines
+			__builtin_prefetch(base + (16*k < n ? 16*k : 0));
+#endif
+			k = 2*k + comp(base[k-1], key); // compiled to a conditional move, no branch on the data
+		}
+		return firstrightancestor(k);
+	}
+
+public:
+	/**
+	 * @brief Builds an empty snapshot.
+	 */
+	FrozenBST() : key_base{nullptr}, value_base{nullptr}, n{0} {}
+	/**
+	 * @brief Copy constructor. A mapped snapshot is not copied: the copy reads the same mapping.
+	 */
+	FrozenBST(const FrozenBST& f) : keys{f.keys}, values{f.values}, key_base{f.key_base}, value_base{f.value_base}, n{f.n}, mapping{f.mapping}, comp{f.comp} { rebase(); }
+	/**
+	 * @brief Move constructor, f is left empty.
+	 */
+	FrozenBST(FrozenBST&& f) noexcept : keys{std::move(f.keys)}, values{std::move(f.values)}, key_base{f.key_base}, value_base{f.value_base},
+		n{f.n}, mapping{std::move(f.mapping)}, comp{std::move(f.comp)} { rebase(); f.n = 0; f.rebase(); }
+	/**
+	 * @brief Copy assignment, see the copy constructor.
+	 */
+	FrozenBST& operator=(const FrozenBST& f)
+	{
+		if(this != &f){
+			FrozenBST tmp{f};
+			*this = std::move(tmp);
+		}
+		return *this;
+	}
+	/**
+	 * @brief Move assignment, f is left empty.
+	 */
+	FrozenBST& operator=(FrozenBST&& f) noexcept
+	{
+		if(this != &f){
+			keys = std::move(f.keys); values = std::move(f.values);
+			key_base = f.key_base; value_base = f.value_base; n = f.n;
+			mapping = std::move(f.mapping); comp = std::move(f.comp);
+			rebase();
+			f.mapping.reset(); f.keys.clear(); f.values.clear(); f.rebase();
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Builds a snapshot from key-value pairs sorted by key and without duplicates.
+	 * @param first Iterator to the first pair.
+	 * @param last Iterator past the last pair.
+	 * @param c The comparison object.
+	 *
+	 * The iterators must dereference to something with a keyvalue member, like the nodes returned by the BST iterators.
+	 */
+	template <class It>
+	FrozenBST(It first, It last, const Compare& c = Compare{});
+
+	/**
+	 * @brief Return the number of elements in the snapshot.
+	 */
+	std::size_t getSize() const noexcept { return n; }
+
+	/**
+	 * @brief Writes the snapshot to a file, to be loaded with load_mapped. Keys and values must be trivially copyable.
+	 * @param path The file to be written.
+	 *
+	 * The file holds a header (format version, byte order, sizes) followed by the keys and then the values, both in
+	 * Eytzinger order and aligned to a cache line. Throws std::runtime_error if the file cannot be written.
+	 */
+	void save(const std::string& path) const;
+
+	/**
+	 * @brief Maps a file written by save in memory and returns a snapshot reading it in place.
+	 * @param path The file to be mapped.
+	 * @param c The comparison object, it must order the keys as the one used to save the file.
+	 * @return FrozenBST The snapshot. The file stays mapped (read-only) as long as a snapshot uses it.
+	 *
+	 * Throws std::runtime_error if the file cannot be mapped, or if it was not written by save with the same key and value
+	 * sizes and the same byte order. Where mmap is not available the arrays are read into memory instead.
+	 */
+	static FrozenBST load_mapped(const std::string& path, const Compare& c = Compare{});
+
+	/**
+	 * @brief Method used to find a key inside the snapshot.
+	 * @param key The key to be found.
+	 * @return ConstIterator An iterator to the element if the key was found, otherwise cend().
+	 */
+	ConstIterator find(const TK& key) const noexcept;
+
+	/**
+	 * @brief Used to begin an iteration on the snapshot.
+	 * @return ConstIterator An iterator to the lowest key.
+	 */
+	ConstIterator cbegin() const noexcept;
+	/**
+	 * @brief Used to end an iteration on the snapshot.
+	 */
+	ConstIterator cend() const noexcept;
+	/**
+	 * @brief Same as cbegin, the snapshot cannot be modified.
+	 */
+	ConstIterator begin() const noexcept { return cbegin(); }
+	/**
+	 * @brief Same as cend, the snapshot cannot be modified.
+	 */
+	ConstIterator end() const noexcept { return cend(); }
+
+	/**
+	 * @brief Operator [] to access the value of a key.
+	 * @param key The key whose value should be accessed.
+	 * @return const TV& The value associated to the key.
+	 *
+	 * Throws std::out_of_range if the key is not present.
+	 */
+	const TV& operator[](const TK& key) const;
+
+	/**
+	 * @brief Operator << to print the snapshot in ascending key order.
+	 * @param os The output stream to which the strings to be printed are appended.
+	 * @param f The snapshot to be printed.
+	 * @return std::ostream& The output stream to which strings have been appended.
+	 */
+	friend std::ostream& operator<<(std::ostream& os, const FrozenBST& f)
+	{
+		if(!f.n)
+			os << "The tree is empty!" << std::endl;
+		for(ConstIterator it = f.cbegin(); it != f.cend(); ++it)
+			os << it.key() << ": " << it.value() << std::endl;
+		return os;
+	}
+};
+
+/**
+ * @brief Constant iterator of FrozenBST: a position in the implicit tree, 0 being the end.
+ */
+template <class TK,class TV,class Compare>
+class FrozenBST<TK, TV, Compare>::ConstIterator
+{
+	/** The snapshot being visited. */
+	const FrozenBST* _f;
+	/** Current position, counting from 1. */
+	std::size_t _k;
+
+public:
+	/**
+	 * @brief Construct an iterator at position k of snapshot f.
+	 * @param f The snapshot.
+	 * @param k The position, 0 for the end.
+	 */
+	ConstIterator(const FrozenBST* f, std::size_t k) noexcept : _f{f}, _k{k} {}
+	/**
+	 * @brief Returns the key of the current element.
+	 */
+	const TK& key() const noexcept { return _f->key_base[_k-1]; }
+	/**
+	 * @brief Returns the value of the current element.
+	 */
+	const TV& value() const noexcept { return _f->value_base[_k-1]; }
+	/**
+	 * @brief Operator for deferencing the iterator.
+	 * @return std::pair<const TK&, const TV&> The key and the value of the current element.
+	 */
+	std::pair<const TK&, const TV&> operator*() const noexcept { return {key(), value()}; }
+	/**
+	 * @brief Operator ++it to advance the iterator to the next key.
+	 *
+	 * The successor is the leftmost element of the right subtree or, if there is no right subtree, the first right ancestor.
+	 */
+	ConstIterator& operator++() noexcept
+	{
+		const std::size_t n = _f->n;
+		if(2*_k+1 <= n){
+			_k = 2*_k+1;
+			while(2*_k <= n) _k = 2*_k;
+		} else
+			_k = firstrightancestor(_k);
+		return *this;
+	}
+	/**
+	 * @brief Operator it++ to advance the iterator to the next key.
+	 */
+	ConstIterator operator++(int) noexcept
+	{
+		ConstIterator it{*this};
+		++(*this);
+		return it;
+	}
+	/**
+	 * @brief Operator == to check for iterators equality.
+	 */
+	bool operator==(const ConstIterator& it) const noexcept { return _k == it._k; }
+	/**
+	 * @brief Operator != to check for iterators inequality.
+	 */
+	bool operator!=(const ConstIterator& it) const noexcept { return _k != it._k; }
+};
+
+template <class TK,class TV,class Compare>
+template <class It>
+FrozenBST<TK, TV, Compare>::FrozenBST(It first, It last, const Compare& c) : key_base{nullptr}, value_base{nullptr}, n{0}, comp{c}
+{
+	std::vector<It> sorted;
+	for(; first != last; ++first)
+		sorted.push_back(first);
+	const std::size_t n = sorted.size(); // the member is set by rebase
+
+	// rank[k-1] is the position in key order of the element k: an in-order visit of the implicit tree
+	std::vector<std::size_t> rank(n);
+	std::size_t next = 0, k = 1;
+	if(n){
+		while(2*k <= n) k = 2*k;
+		for(; k; ++next){
+			rank[k-1] = next;
+			if(2*k+1 <= n){
+				k = 2*k+1;
+				while(2*k <= n) k = 2*k;
+			} else
+				k = firstrightancestor(k);
+		}
+	}
+
+	keys.reserve(n);
+	values.reserve(n);
+	for(std::size_t i = 0; i < n; ++i){
+		keys.push_back((*sorted[rank[i]])->keyvalue.first);
+		values.push_back((*sorted[rank[i]])->keyvalue.second);
+	}
+	rebase();
+}
+
+template <class TK,class TV,class Compare>
+typename FrozenBST<TK, TV, Compare>::ConstIterator FrozenBST<TK, TV, Compare>::find(const TK& key) const noexcept
+{
+	std::size_t k = lowerBound(key);
+	if(k && !comp(key, key_base[k-1]))
+		return ConstIterator{this, k};
+	return cend();
+}
+
+template <class TK,class TV,class Compare>
+typename FrozenBST<TK, TV, Compare>::ConstIterator FrozenBST<TK, TV, Compare>::cbegin() const noexcept
+{
+	std::size_t k = n ? 1 : 0;
+	while(k && 2*k <= n) k = 2*k;
+	return ConstIterator{this, k};
+}
+
+template <class TK,class TV,class Compare>
+typename FrozenBST<TK, TV, Compare>::ConstIterator FrozenBST<TK, TV, Compare>::cend() const noexcept
+{
+	return ConstIterator{this, 0};
+}
+
+template <class TK,class TV,class Compare>
+const TV& FrozenBST<TK, TV, Compare>::operator[](const TK& key) const
+{
+	ConstIterator it{find(key)};
+	if(it == cend())
+		throw std::out_of_range{"The key is not present in the tree."};
+	return it.value();
+}
+
+template <class TK,class TV,class Compare>
+void FrozenBST<TK, TV, Compare>::save(const std::string& path) const
+{
+	static_assert(std::is_trivially_copyable<TK>::value && std::is_trivially_copyable<TV>::value,
+	              "Only trivially copyable keys and values can be saved.");
+	static_assert(alignof(TK) <= file_alignment && alignof(TV) <= file_alignment, "The keys and values are over-aligned.");
+	FileHeader h{};
+	std::memcpy(h.magic, "BSTSNAP", 8);
+	h.version = file_version;
+	h.endianness = 0x01020304;
+	h.key_size = sizeof(TK);
+	h.value_size = sizeof(TV);
+	h.count = n;
+	h.keys_offset = aligned(sizeof(FileHeader));
+	h.values_offset = aligned(h.keys_offset + n * sizeof(TK));
+
+	std::ofstream out{path, std::ios::binary | std::ios::trunc};
+	const char padding[file_alignment] = {};
+	out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	out.write(padding, std::streamsize(h.keys_offset - sizeof(h)));
+	out.write(reinterpret_cast<const char*>(key_base), std::streamsize(n * sizeof(TK)));
+	out.write(padding, std::streamsize(h.values_offset - h.keys_offset - n * sizeof(TK)));
+	out.write(reinterpret_cast<const char*>(value_base), std::streamsize(n * sizeof(TV)));
+	if(!out)
+		throw std::runtime_error{"Cannot write the snapshot to " + path};
+}
+
+template <class TK,class TV,class Compare>
+FrozenBST<TK, TV, Compare> FrozenBST<TK, TV, Compare>::load_mapped(const std::string& path, const Compare& c)
+{
+	static_assert(std::is_trivially_copyable<TK>::value && std::is_trivially_copyable<TV>::value,
+	              "Only trivially copyable keys and values can be loaded.");
+	FrozenBST f;
+	f.comp = c;
+	auto check = [&path](const FileHeader& h, std::uint64_t size){
+		if(size < sizeof(FileHeader) || std::memcmp(h.magic, "BSTSNAP", 8) != 0)
+			throw std::runtime_error{path + " is not a tree snapshot"};
+		if(h.endianness != 0x01020304)
+			throw std::runtime_error{path + " was saved with a different byte order"};
+		if(h.version != file_version || h.key_size != sizeof(TK) || h.value_size != sizeof(TV))
+			throw std::runtime_error{path + " was saved with a different format, key type or value type"};
+		// written as divisions: offset + count * size could wrap around with the numbers of a corrupted header
+		auto fits = [size](std::uint64_t offset, std::uint64_t count, std::uint64_t element){
+			return offset <= size && count <= (size - offset) / element;
+		};
+		if(h.keys_offset % file_alignment || h.values_offset % file_alignment
+		   || !fits(h.keys_offset, h.count, sizeof(TK)) || !fits(h.values_offset, h.count, sizeof(TV)))
+			throw std::runtime_error{path + " is truncated or corrupted"};
+	};
+#if defined(__unix__) || defined(__APPLE__)
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error{"Cannot open " + path};
+	struct stat st;
+	if(::fstat(fd, &st) != 0 || std::uint64_t(st.st_size) < sizeof(FileHeader)){
+		::close(fd);
+		throw std::runtime_error{path + " is not a tree snapshot"};
+	}
+	const std::size_t length = std::size_t(st.st_size);
+	void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping stays valid
+	if(addr == MAP_FAILED)
+		throw std::runtime_error{"Cannot map " + path};
+	f.mapping = std::shared_ptr<const void>(addr, [length](const void* p){ ::munmap(const_cast<void*>(p), length); });
+	const char* bytes = static_cast<const char*>(addr);
+	const FileHeader& h = *reinterpret_cast<const FileHeader*>(bytes);
+	check(h, length);
+	f.key_base = reinterpret_cast<const TK*>(bytes + h.keys_offset);
+	f.value_base = reinterpret_cast<const TV*>(bytes + h.values_offset);
+	f.n = std::size_t(h.count);
+#else
+	std::ifstream in{path, std::ios::binary | std::ios::ate};
+	if(!in)
+		throw std::runtime_error{"Cannot open " + path};
+	std::vector<char> bytes(std::size_t(in.tellg()));
+	in.seekg(0);
+	in.read(bytes.data(), std::streamsize(bytes.size()));
+	FileHeader h{};
+	if(bytes.size() >= sizeof(FileHeader))
+		std::memcpy(&h, bytes.data(), sizeof(FileHeader));
+	check(h, bytes.size());
+	f.keys.resize(std::size_t(h.count));
+	f.values.resize(std::size_t(h.count));
+	std::memcpy(f.keys.data(), bytes.data() + h.keys_offset, f.keys.size() * sizeof(TK));
+	std::memcpy(f.values.data(), bytes.data() + h.values_offset, f.values.size() * sizeof(TV));
+	f.rebase();
+#endif
+	return f;
+}
+
+#endif //BST_FROZEN_H__
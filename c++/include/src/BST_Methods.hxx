@@ -10,70 +10,626 @@
 // Private Methods
 
 
-template <class TK,class TV>
-void BST<TK, TV>::copy(const std::unique_ptr<Node>& node)
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::cloneChildren(const Node* s, Node* d, int cut, std::vector<std::pair<const Node*, Node*>>* pending)
 {
-    if(node)
-    {
-        insert(node->keyvalue);
-        copy(node->left);
-        copy(node->right);
+    const Node* top = s;
+    int depth = 0;
+    auto clone = [this](const Node* src, Node* parent){
+        Node* n = createNode(parent, src->keyvalue);
+        n->height = src->height; // the shape is the same, no need to recompute
+        n->count = src->count;
+        return NodePtr{n};
+    };
+    for(;;){
+        if(depth == cut)
+            pending->emplace_back(s, d);
+        else if(s->left && !d->left){
+            d->left = clone(s->left.get(), d);
+            s = s->left.get(); d = d->left.get(); ++depth;
+            continue;
+        } else if(s->right && !d->right){
+            d->right = clone(s->right.get(), d);
+            s = s->right.get(); d = d->right.get(); ++depth;
+            continue;
+        }
+        // all the children of s have been cloned (or left to someone else)
+        if(s == top) return;
+        s = s->parent; d = d->parent; --depth;
+    }
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::copy(const BST& bst, unsigned threads)
+{
+    if(!bst.root) return;
+    try{
+        root.reset(createNode(nullptr, bst.root->keyvalue));
+        root->height = bst.root->height;
+        root->count = bst.root->count;
+        if(threads < 2 || !std::is_same<A, HeapAllocation>::value || bst.getSize() < 4096){
+            cloneChildren(bst.root.get(), root.get(), -1, nullptr);
+            return;
+        }
+
+        // the top levels are cloned here, at least two subtrees per thread are left below them
+        int cut = 1;
+        while((1u << cut) < 2*threads && cut < 16) ++cut;
+        std::vector<std::pair<const Node*, Node*>> pending;
+        cloneChildren(bst.root.get(), root.get(), cut, &pending);
+
+        std::atomic<std::size_t> next{0};
+        std::vector<std::exception_ptr> errors(threads);
+        auto work = [this, &pending, &next, &errors](unsigned t){
+            try{
+                for(std::size_t i = next++; i < pending.size(); i = next++)
+                    cloneChildren(pending[i].first, pending[i].second, -1, nullptr);
+            } catch(...){
+                errors[t] = std::current_exception();
+                next = pending.size(); // the other threads stop after their current subtree
+            }
+        };
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        try{
+            for(unsigned t = 1; t < threads; ++t)
+                workers.emplace_back(work, t);
+        } catch(...){
+            // a thread could not be started: the subtrees are shared by the threads already running and this one
+        }
+        work(0);
+        for(auto& w : workers)
+            w.join();
+        for(auto& e : errors)
+            if(e) std::rethrow_exception(e); // the partial clones are linked to root, clear frees them
+    } catch(...){
+        clear();
+        throw;
     }
 }
 
-template <class TK,class TV>
-void BST<TK, TV>::rebuildBalancedTree(std::vector< std::pair<TK,TV> > &v, int start, int end)
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::NodePtr BST<TK, TV, B, A, C, S>::rebuildBalancedTree(std::vector<Node*>& v, int start, int end, Node* parent)
 {
-    if(start>end) return;
+    if(start>end) return NodePtr{};
 
-    if(start==end) {insert(v[start]); return;}
-        
     int mid = (start+end)/2;
-    insert(v[mid]);
-    rebuildBalancedTree(v, start, mid-1);
-    rebuildBalancedTree(v, mid+1, end);
+    NodePtr node{v[mid]};
+    node->parent = parent;
+    node->left = rebuildBalancedTree(v, start, mid-1, node.get());
+    node->right = rebuildBalancedTree(v, mid+1, end, node.get());
+    node->update();
+    return node;
 }
 
+template <class TK,class TV,class B,class A,class C,class S>
+std::vector<typename BST<TK, TV, B, A, C, S>::Node*> BST<TK, TV, B, A, C, S>::flatten()
+{
+    std::vector<Node*> v;
+    v.reserve(getSize());
+    for (auto x :  *this)
+        v.push_back(x);
+    // the links are dropped only once the traversal is over
+    for (Node* x : v){
+        x->left.release();
+        x->right.release();
+    }
+    root.release();
+    return v;
+}
 
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::sortByKey(std::vector<std::pair<TK, TV>>& v, unsigned threads) const
+{
+    auto less = [this](const std::pair<TK, TV>& a, const std::pair<TK, TV>& b){ return comp(a.first, b.first); };
+    std::size_t n = v.size();
+    if(threads < 2 || n < 2*threads){
+        std::stable_sort(v.begin(), v.end(), less);
+        return;
+    }
+    // chunk i covers [bounds[i], bounds[i+1])
+    std::vector<std::size_t> bounds;
+    for(unsigned i = 0; i <= threads; ++i)
+        bounds.push_back(n*i/threads);
+    // runs independent tasks one per thread, on this thread those whose thread cannot be started;
+    // every thread is joined before the first exception is rethrown
+    auto run = [](std::vector<std::function<void()>>& tasks){
+        std::vector<std::exception_ptr> errors(tasks.size());
+        std::vector<std::thread> workers;
+        workers.reserve(tasks.size());
+        std::size_t started = 0;
+        try{
+            for(; started < tasks.size(); ++started)
+                workers.emplace_back([&tasks, &errors, started](){
+                    try{ tasks[started](); }
+                    catch(...){ errors[started] = std::current_exception(); }
+                });
+        } catch(...){}
+        for(std::size_t i = started; i < tasks.size(); ++i){
+            try{ tasks[i](); }
+            catch(...){ errors[i] = std::current_exception(); }
+        }
+        for(auto& w : workers) w.join();
+        for(auto& e : errors)
+            if(e) std::rethrow_exception(e);
+    };
+    std::vector<std::function<void()>> tasks;
+    for(unsigned i = 0; i < threads; ++i)
+        tasks.push_back([&v, &bounds, less, i](){
+            std::stable_sort(v.begin()+bounds[i], v.begin()+bounds[i+1], less);
+        });
+    run(tasks);
+    // adjacent chunks are merged pairwise, doubling the chunk width at each pass
+    for(std::size_t width = 1; width < threads; width *= 2){
+        tasks.clear();
+        for(std::size_t i = 0; i + width < threads; i += 2*width){
+            std::size_t lo = bounds[i], mid = bounds[i+width], hi = bounds[std::min<std::size_t>(i+2*width, threads)];
+            tasks.push_back([&v, less, lo, mid, hi](){
+                std::inplace_merge(v.begin()+lo, v.begin()+mid, v.begin()+hi, less);
+            });
+        }
+        run(tasks);
+    }
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::NodePtr& BST<TK, TV, B, A, C, S>::owner(Node* node) noexcept
+{
+    if(!node->parent) return root;
+    if(node->parent->left.get() == node) return node->parent->left;
+    return node->parent->right;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::retrace(Node* node)
+{
+    while(node){
+        NodePtr& slot = owner(node);
+        node->update();
+        B::rebalance(slot); // slot now owns the (possibly new) subtree root
+        node = slot->parent;
+    }
+}
 
 // Public methods
 
-template <class TK,class TV>
-void BST<TK, TV>::insert(const std::pair<TK, TV> kv){
-    int h = 1;
-    Node * parent = root.get();
-    if( !parent ) {root.reset(new Node{kv});}// if tree is empty insert node as root
-    else{
-       
-        while(1){
-            if(parent->keyvalue.first==kv.first){
-                parent->keyvalue.second=kv.second;
-                break;
-            }else if(parent->keyvalue.first < kv.first){
-                h++;
-                if(parent->right)
-                    parent=(parent->right).get();
-                else{
-                    parent->right.reset(new Node{kv,parent});
-                    break;
-                } 
-            } else {
-                h++;
-                if(parent->left)
-                    parent=(parent->left).get();
-                else{
-                    parent->left.reset(new Node{kv,parent});
-                    break;
-                }
-            }
+template <class TK,class TV,class B,class A,class C,class S>
+template <class K, class F>
+std::pair<typename BST<TK, TV, B, A, C, S>::Node*, bool> BST<TK, TV, B, A, C, S>::insertNode(const K& key, F make)
+{
+    Node * parent = nullptr;
+    NodePtr * slot = &root; // if tree is empty the node is inserted as root
+    int comparisons = 0;
+    while(*slot){
+        parent = slot->get();
+        comparisons += 2;
+        if(comp(key, parent->keyvalue.first)){
+            --comparisons;
+            slot = &parent->left;
+        } else if(comp(parent->keyvalue.first, key))
+            slot = &parent->right;
+        else{
+            recorder.insert(comparisons);
+            return {parent, false};
+        }
+    }
+    recorder.insert(comparisons);
+    slot->reset(make(parent));
+    Node * node = slot->get();
+    retrace(parent); // the counts of all the ancestors grow by one
+    return {node, true};
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class K, class... Args>
+std::pair<typename BST<TK, TV, B, A, C, S>::Node*, bool> BST<TK, TV, B, A, C, S>::tryEmplaceNode(K&& key, Args&&... args)
+{
+    return insertNode(key, [&](Node* parent){
+        return createNode(parent, std::piecewise_construct,
+                            std::forward_as_tuple(std::forward<K>(key)),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class M>
+std::pair<typename BST<TK, TV, B, A, C, S>::Iterator, bool> BST<TK, TV, B, A, C, S>::insert_or_assign(const TK& key, M&& value)
+{
+    std::pair<Node*, bool> r = insertNode(key, [&](Node* parent){
+        return createNode(parent, key, std::forward<M>(value));
+    });
+    if(!r.second) r.first->keyvalue.second = std::forward<M>(value); // the value was not used to build a node
+    return {Iterator{r.first}, r.second};
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class M>
+std::pair<typename BST<TK, TV, B, A, C, S>::Iterator, bool> BST<TK, TV, B, A, C, S>::insert_or_assign(TK&& key, M&& value)
+{
+    std::pair<Node*, bool> r = insertNode(key, [&](Node* parent){
+        return createNode(parent, std::move(key), std::forward<M>(value));
+    });
+    if(!r.second) r.first->keyvalue.second = std::forward<M>(value); // the value was not used to build a node
+    return {Iterator{r.first}, r.second};
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class... Args>
+std::pair<typename BST<TK, TV, B, A, C, S>::Iterator, bool> BST<TK, TV, B, A, C, S>::emplace(Args&&... args)
+{
+    Node * node = createNode(nullptr, std::forward<Args>(args)...);
+    std::pair<Node*, bool> r;
+    try{
+        r = insertNode(node->keyvalue.first, [node](Node* parent){ node->parent = parent; return node; });
+    } catch(...){
+        destroyNode(node);
+        throw;
+    }
+    if(!r.second) destroyNode(node);
+    return {Iterator{r.first}, r.second};
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class... Args>
+std::pair<typename BST<TK, TV, B, A, C, S>::Iterator, bool> BST<TK, TV, B, A, C, S>::try_emplace(const TK& key, Args&&... args)
+{
+    std::pair<Node*, bool> r = tryEmplaceNode(key, std::forward<Args>(args)...);
+    return {Iterator{r.first}, r.second};
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class... Args>
+std::pair<typename BST<TK, TV, B, A, C, S>::Iterator, bool> BST<TK, TV, B, A, C, S>::try_emplace(TK&& key, Args&&... args)
+{
+    std::pair<Node*, bool> r = tryEmplaceNode(std::move(key), std::forward<Args>(args)...);
+    return {Iterator{r.first}, r.second};
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+int BST<TK, TV, B, A, C, S>::erase(const TK& key)
+{
+    Node * node = findNode(key);
+    if(!node) return 0;
+
+    Node * parent = node->parent;
+    NodePtr& slot = owner(node);
+    NodePtr victim = std::move(slot);
+    Node * first; // the lowest node whose subtree has changed
+    if(!victim->left || !victim->right){
+        slot = victim->left ? std::move(victim->left) : std::move(victim->right);
+        if(slot) slot->parent = parent;
+        first = parent;
+    } else {
+        // the successor is the leftmost node of the right subtree, it has no left child
+        Node * succ = victim->right->leftmostdescent();
+        NodePtr moved;
+        if(succ == victim->right.get()){
+            moved = std::move(victim->right);
+            first = succ;
+        } else {
+            Node * sp = succ->parent;
+            moved = std::move(sp->left);
+            sp->left = std::move(moved->right);
+            if(sp->left) sp->left->parent = sp;
+            moved->right = std::move(victim->right);
+            moved->right->parent = succ;
+            first = sp;
         }
+        moved->left = std::move(victim->left);
+        moved->left->parent = succ;
+        moved->parent = parent;
+        slot = std::move(moved);
     }
-    size++;
-    if(getHeight()<h) height=h;
+    destroyNode(victim.release());
+    retrace(first);
+    return 1;
 }
 
-template <class TK,class TV>
-std::ostream& BST<TK, TV>::printOrderedList(std::ostream& os) const
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::clear() noexcept
+{
+    if(A::bulk_release && std::is_trivially_destructible<std::pair<const TK, TV>>::value){
+        recorder.freed(std::size_t(getSize()), sizeof(Node));
+        root.release(); // nothing to destroy, the memory goes away with the blocks
+    }
+    else
+        destroySubtree(root.release());
+    nodes.release();
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::destroySubtree(Node* n) noexcept
+{
+    // right rotations turn the tree into a vine hanging on the right, whose top node has no left child and can be destroyed
+    while(n){
+        if(n->left){
+            Node* l = n->left.release();
+            n->left.reset(l->right.release());
+            l->right.reset(n);
+            n = l;
+        } else {
+            Node* r = n->right.release();
+            destroyNode(n);
+            n = r;
+        }
+    }
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::NodePtr BST<TK, TV, B, A, C, S>::joinNodes(NodePtr l, NodePtr k, NodePtr r)
+{
+    auto height = [](const NodePtr& n){ return n ? n->height : 0; };
+    const int hl = height(l), hr = height(r);
+    if(B::self_balancing && (hl > hr + 1 || hr > hl + 1)){
+        // walk down the inner spine of the taller subtree until the height of the shorter one
+        const bool left_taller = hl > hr;
+        NodePtr& top = left_taller ? l : r;
+        const int h = left_taller ? hr : hl;
+        std::vector<NodePtr*> spine;
+        NodePtr * slot = &top;
+        while(height(*slot) > h + 1){
+            spine.push_back(slot);
+            slot = left_taller ? &(*slot)->right : &(*slot)->left;
+        }
+        Node * parent = spine.back()->get();
+        if(left_taller){
+            k->left = std::move(*slot);
+            k->right = std::move(r);
+        } else {
+            k->left = std::move(l);
+            k->right = std::move(*slot);
+        }
+        if(k->left) k->left->parent = k.get();
+        if(k->right) k->right->parent = k.get();
+        k->parent = parent;
+        k->update();
+        *slot = std::move(k);
+        for(auto it = spine.rbegin(); it != spine.rend(); ++it){
+            (**it)->update();
+            B::rebalance(**it);
+        }
+        top->parent = nullptr;
+        return std::move(top);
+    }
+    k->left = std::move(l);
+    k->right = std::move(r);
+    if(k->left) k->left->parent = k.get();
+    if(k->right) k->right->parent = k.get();
+    k->parent = nullptr;
+    k->update();
+    return k;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::NodePtr BST<TK, TV, B, A, C, S>::joinNodes(NodePtr l, NodePtr r)
+{
+    if(!l || !r){
+        NodePtr t = l ? std::move(l) : std::move(r);
+        if(t) t->parent = nullptr;
+        return t;
+    }
+    // the greatest node of l is detached and becomes the middle node
+    std::vector<NodePtr*> path;
+    NodePtr * slot = &l;
+    while((*slot)->right){
+        path.push_back(slot);
+        slot = &(*slot)->right;
+    }
+    NodePtr m = std::move(*slot);
+    *slot = std::move(m->left);
+    if(*slot) (*slot)->parent = m->parent;
+    for(auto it = path.rbegin(); it != path.rend(); ++it){
+        (**it)->update();
+        B::rebalance(**it);
+    }
+    return joinNodes(std::move(l), std::move(m), std::move(r));
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::splitNodes(NodePtr t, const TK& key, NodePtr& l, NodePtr& m, NodePtr& r)
+{
+    // nodes of the path lower than key keep their left subtree, the greater ones keep their right subtree
+    std::vector<NodePtr> lower, upper;
+    NodePtr cur = std::move(t);
+    while(cur){
+        if(comp(cur->keyvalue.first, key)){
+            NodePtr next = std::move(cur->right);
+            lower.push_back(std::move(cur));
+            cur = std::move(next);
+        } else if(comp(key, cur->keyvalue.first)){
+            NodePtr next = std::move(cur->left);
+            upper.push_back(std::move(cur));
+            cur = std::move(next);
+        } else {
+            l = std::move(cur->left);
+            r = std::move(cur->right);
+            m = std::move(cur);
+            m->parent = nullptr;
+            m->update();
+        }
+    }
+    // the subtrees of the node equal to key are roots now, they must not point to it any more
+    if(l) l->parent = nullptr;
+    if(r) r->parent = nullptr;
+    // the deepest pieces are joined first: with AVLBalancing the costs of the joins telescope to O(log n)
+    while(!lower.empty()){
+        NodePtr n = std::move(lower.back());
+        lower.pop_back();
+        NodePtr nl = std::move(n->left);
+        l = joinNodes(std::move(nl), std::move(n), std::move(l));
+    }
+    while(!upper.empty()){
+        NodePtr n = std::move(upper.back());
+        upper.pop_back();
+        NodePtr nr = std::move(n->right);
+        r = joinNodes(std::move(r), std::move(n), std::move(nr));
+    }
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::NodePtr BST<TK, TV, B, A, C, S>::combineNodes(NodePtr a, NodePtr b, int op, unsigned threads)
+{
+    if(!a || !b){
+        if(op == 1){
+            destroySubtree(a.release());
+            destroySubtree(b.release());
+        } else if(op == 2)
+            destroySubtree(b.release());
+        return joinNodes(std::move(a), std::move(b)); // at most one of them is left
+    }
+    const bool parallel = threads > 1 && std::is_same<A, HeapAllocation>::value && a->count + b->count >= (1 << 14);
+
+    NodePtr l2, m, r2;
+    splitNodes(std::move(b), a->keyvalue.first, l2, m, r2);
+    NodePtr l1 = std::move(a->left);
+    NodePtr r1 = std::move(a->right);
+    NodePtr l, r;
+    if(parallel){
+        std::exception_ptr error;
+        std::thread worker;
+        try{
+            worker = std::thread([&](){
+                try{ l = combineNodes(std::move(l1), std::move(l2), op, threads / 2); }
+                catch(...){ error = std::current_exception(); }
+            });
+        } catch(const std::system_error&){
+            l = combineNodes(std::move(l1), std::move(l2), op, 1);
+        }
+        try{
+            r = combineNodes(std::move(r1), std::move(r2), op, threads - threads / 2);
+        } catch(...){
+            if(worker.joinable()) worker.join();
+            throw;
+        }
+        if(worker.joinable()) worker.join();
+        if(error) std::rethrow_exception(error);
+    } else {
+        l = combineNodes(std::move(l1), std::move(l2), op, 1);
+        r = combineNodes(std::move(r1), std::move(r2), op, 1);
+    }
+
+    const bool keep = op == 0 || (op == 1) == bool(m);
+    if(m){
+        if(op == 0) a->keyvalue.second = std::move(m->keyvalue.second); // as in insert, the value of the other tree wins
+        destroyNode(m.release());
+    }
+    if(keep)
+        return joinNodes(std::move(l), std::move(a), std::move(r));
+    destroyNode(a.release());
+    return joinNodes(std::move(l), std::move(r));
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::prepareCombine(BST& other)
+{
+    nodes.share(other.nodes); // the nodes of other may end up in this tree or be destroyed by it
+    if(!B::self_balancing){
+        // the recursion follows the shape of this tree: a degenerate tree is balanced first
+        int bound = 16;
+        for(int n = getSize(); n; n >>= 1) bound += 2;
+        if(getHeight() > bound) balance();
+    }
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+BST<TK, TV, B, A, C, S> BST<TK, TV, B, A, C, S>::split(const TK& key)
+{
+    BST upper;
+    upper.comp = comp;
+    upper.nodes.share(nodes);
+    NodePtr l, m, r;
+    splitNodes(std::move(root), key, l, m, r);
+    if(m) r = joinNodes(NodePtr{}, std::move(m), std::move(r));
+    root = std::move(l);
+    upper.root = std::move(r);
+    if(root) root->parent = nullptr;
+    if(upper.root) upper.root->parent = nullptr;
+    return upper;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+BST<TK, TV, B, A, C, S> BST<TK, TV, B, A, C, S>::join(BST&& left, BST&& right)
+{
+    BST result{std::move(left)};
+    if(&right == &left) return result;
+    result.nodes.share(right.nodes);
+    result.root = result.joinNodes(std::move(result.root), std::move(right.root));
+    right.clear();
+    return result;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::union_with(BST&& other, unsigned threads)
+{
+    if(&other == this) return;
+    prepareCombine(other);
+    root = combineNodes(std::move(root), std::move(other.root), 0, threads);
+    other.clear();
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::intersect_with(BST&& other, unsigned threads)
+{
+    if(&other == this) return;
+    prepareCombine(other);
+    root = combineNodes(std::move(root), std::move(other.root), 1, threads);
+    other.clear();
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::difference_with(BST&& other, unsigned threads)
+{
+    if(&other == this){
+        clear();
+        return;
+    }
+    prepareCombine(other);
+    root = combineNodes(std::move(root), std::move(other.root), 2, threads);
+    other.clear();
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class InputIt>
+void BST<TK, TV, B, A, C, S>::bulk_insert(InputIt first, InputIt last, unsigned threads)
+{
+    std::vector<std::pair<TK, TV>> kv(first, last);
+    if(kv.empty()) return;
+    auto less = [this](const std::pair<TK, TV>& a, const std::pair<TK, TV>& b){ return comp(a.first, b.first); };
+    if(!std::is_sorted(kv.begin(), kv.end(), less))
+        sortByKey(kv, threads);
+
+    // one node for the last pair of every run of equal keys, allocated before touching the tree
+    std::vector<Node*> fresh;
+    fresh.reserve(kv.size());
+    try{
+        for(std::size_t i = 0; i < kv.size(); ++i)
+            if(i+1 == kv.size() || comp(kv[i].first, kv[i+1].first))
+                fresh.push_back(createNode(std::move(kv[i])));
+    } catch(...){
+        for(Node* x : fresh) destroyNode(x);
+        throw;
+    }
+
+    std::vector<Node*> old{flatten()};
+    std::vector<Node*> merged;
+    merged.reserve(old.size() + fresh.size());
+    std::size_t i = 0, j = 0;
+    while(i < old.size() || j < fresh.size()){
+        if(j == fresh.size() || (i < old.size() && comp(old[i]->keyvalue.first, fresh[j]->keyvalue.first)))
+            merged.push_back(old[i++]);
+        else if(i == old.size() || comp(fresh[j]->keyvalue.first, old[i]->keyvalue.first))
+            merged.push_back(fresh[j++]);
+        else{ // same key: the existing node takes the new value
+            old[i]->keyvalue.second = std::move(fresh[j]->keyvalue.second);
+            destroyNode(fresh[j++]);
+            merged.push_back(old[i++]);
+        }
+    }
+    root = rebuildBalancedTree(merged, 0, int(merged.size()) - 1, nullptr);
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+std::ostream& BST<TK, TV, B, A, C, S>::printOrderedList(std::ostream& os) const
 {
     ConstIterator it{cbegin()};
     ConstIterator end{cend()};
@@ -89,42 +645,329 @@ std::ostream& BST<TK, TV>::printOrderedList(std::ostream& os) const
 }
 
 
-template <class TK,class TV>
-typename BST<TK, TV>::Iterator BST<TK, TV>::find(TK key) const
+template <class TK,class TV,class B,class A,class C,class S>
+template <class K>
+typename BST<TK, TV, B, A, C, S>::Node* BST<TK, TV, B, A, C, S>::findNode(const K& key) const
 {
     Node * current= root.get();
-    while(current)
-        if(key == current->keyvalue.first)
-            return Iterator(current);
-        else if(key < current->keyvalue.first)
+    int depth = 0, comparisons = 0; // optimized away with NoStats
+    while(current){
+        ++depth;
+        comparisons += 2;
+        if(comp(key, current->keyvalue.first)){
+            --comparisons;
             current = current->left.get();
+        } else if(comp(current->keyvalue.first, key))
+            current = current->right.get();
         else
+            break;
+    }
+    recorder.find(depth, comparisons);
+    return current;
+}
+
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class ForwardIt, class OutputIt>
+OutputIt BST<TK, TV, B, A, C, S>::find_many(ForwardIt first, ForwardIt last, OutputIt out) const
+{
+    if(first == last) return out;
+    auto less = [this](const decltype(*first)& a, const decltype(*first)& b){ return comp(a, b); };
+
+    if(std::is_sorted(first, last, less)){
+        // lower is the first node whose key is not lower than the previous key, nullptr if there is none
+        Node * lower = root ? root.get() : nullptr;
+        bool fresh = true; // no descent done yet: start from the root
+        for(; first != last; ++first){
+            const auto& key = *first;
+            Node * x = lower;
+            if(!fresh && x){
+                if(comp(key, x->keyvalue.first)){ // nothing between the previous key and lower
+                    *out++ = Iterator{nullptr};
+                    continue;
+                }
+                // climb while the first right ancestor is not greater than the key: then the key is in the subtree of x
+                for(Node * r = x->firstrightancestor(); r && !comp(key, r->keyvalue.first); r = x->firstrightancestor())
+                    x = r;
+                lower = x->firstrightancestor();
+                if(!comp(x->keyvalue.first, key)){ // x holds the key
+                    lower = x;
+                    *out++ = Iterator{x};
+                    continue;
+                }
+                x = x->right.get();
+            } else
+                lower = nullptr;
+            fresh = false;
+            Node * found = nullptr;
+            while(x){
+                if(comp(key, x->keyvalue.first)){
+                    lower = x;
+                    x = x->left.get();
+                } else if(comp(x->keyvalue.first, key))
+                    x = x->right.get();
+                else{
+                    found = lower = x;
+                    break;
+                }
+            }
+            *out++ = Iterator{found};
+        }
+        return out;
+    }
+
+    const int group = 16;
+    ForwardIt keys[group];
+    Node * current[group];
+    Node * found[group];
+    while(first != last){
+        int n = 0;
+        for(; n < group && first != last; ++n, ++first){
+            keys[n] = first;
+            current[n] = root.get();
+            found[n] = nullptr;
+        }
+        for(int active = n; active > 0; ){
+            active = 0;
+            for(int i = 0; i < n; ++i){
+                Node * x = current[i];
+                if(!x) continue;
+                if(comp(*keys[i], x->keyvalue.first))
+                    x = x->left.get();
+                else if(comp(x->keyvalue.first, *keys[i]))
+                    x = x->right.get();
+                else{
+                    found[i] = x;
+                    x = nullptr;
+                }
+                current[i] = x;
+                if(x){
+#if defined(__GNUC__)
+                    __builtin_prefetch(x);
+#endif
+                    ++active;
+                }
+            }
+        }
+        for(int i = 0; i < n; ++i)
+            *out++ = Iterator{found[i]};
+    }
+    return out;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::Iterator BST<TK, TV, B, A, C, S>::lower_bound(const TK& key) const
+{
+    Node * current = root.get();
+    Node * lower = nullptr;
+    while(current)
+        if(comp(current->keyvalue.first, key))
             current = current->right.get();
-    return end();
+        else{
+            lower = current;
+            current = current->left.get();
+        }
+    return Iterator{lower};
 }
 
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::Iterator BST<TK, TV, B, A, C, S>::upper_bound(const TK& key) const
+{
+    Node * current = root.get();
+    Node * upper = nullptr;
+    while(current)
+        if(comp(key, current->keyvalue.first)){
+            upper = current;
+            current = current->left.get();
+        } else
+            current = current->right.get();
+    return Iterator{upper};
+}
 
-template <class TK,class TV>
-void BST<TK, TV>::balance()
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::Range BST<TK, TV, B, A, C, S>::range(const TK& a, const TK& b) const
 {
-    std::vector< std::pair<TK,TV> > v;
-    for (auto x :  *this)
-        v.push_back(x->keyvalue);
-    clear();
-    rebuildBalancedTree(v, 0, v.size() - 1);
-    
+    if(!comp(a, b)) return Range{end(), end()};
+    return Range{lower_bound(a), lower_bound(b)};
 }
 
-template <class TK,class TV>
-typename BST<TK, TV>::Iterator BST<TK, TV>::begin()
+template <class TK,class TV,class B,class A,class C,class S>
+int BST<TK, TV, B, A, C, S>::rank(const TK& key) const
+{
+    Node * current = root.get();
+    int r = 0;
+    while(current)
+        if(comp(current->keyvalue.first, key)){
+            // the node and its whole left subtree are lower than key
+            r += 1 + (current->left ? current->left->count : 0);
+            current = current->right.get();
+        } else
+            current = current->left.get();
+    return r;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::Iterator BST<TK, TV, B, A, C, S>::select(int k) const
+{
+    if(k < 0 || k >= getSize()) return end();
+    Node * current = root.get();
+    while(current){
+        int left = current->left ? current->left->count : 0;
+        if(k < left)
+            current = current->left.get();
+        else if(k == left)
+            break;
+        else{
+            k -= left + 1;
+            current = current->right.get();
+        }
+    }
+    return Iterator{current};
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+std::vector<typename BST<TK, TV, B, A, C, S>::Range> BST<TK, TV, B, A, C, S>::subranges(unsigned pieces) const
+{
+    std::vector<Range> ranges;
+    if(!root) return ranges;
+    const int grain = std::max(1, getSize() / int(std::max(1u, pieces)));
+
+    Node * first = nullptr; // first node of the range being built
+    Node * last = nullptr;  // node past the range being built
+    int size = 0;
+    auto add = [&](Node * begin, Node * end, int n){
+        if(size && size + n > grain){
+            ranges.emplace_back(Iterator{first}, Iterator{last}, size);
+            size = 0;
+        }
+        if(!size) first = begin;
+        last = end;
+        size += n;
+    };
+
+    // in-order visit of the nodes being split, with an explicit stack: the splitting stops at small subtrees
+    std::vector<Node*> stack;
+    Node * n = root.get();
+    while(n || !stack.empty()){
+        if(n){
+            if(n->count <= grain){
+                add(n->leftmostdescent(), n->firstrightancestor(), n->count);
+                n = nullptr;
+            } else {
+                stack.push_back(n);
+                n = n->left.get();
+            }
+        } else {
+            n = stack.back();
+            stack.pop_back();
+            Node * next = n->right ? n->right->leftmostdescent() : n->firstrightancestor();
+            add(n, next, 1);
+            n = n->right.get();
+        }
+    }
+    if(size) ranges.emplace_back(Iterator{first}, Iterator{last}, size);
+    return ranges;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class F>
+void BST<TK, TV, B, A, C, S>::visitRanges(const std::vector<Range>& ranges, unsigned threads, F visit)
+{
+    threads = std::max(1u, std::min<unsigned>(threads, unsigned(ranges.size())));
+    std::atomic<std::size_t> next{0};
+    std::vector<std::exception_ptr> errors(threads);
+    auto work = [&](unsigned t){
+        try{
+            for(std::size_t i = next++; i < ranges.size(); i = next++)
+                visit(i);
+        } catch(...){
+            errors[t] = std::current_exception();
+            next = ranges.size(); // the other threads stop after their current range
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    try{
+        for(unsigned t = 1; t < threads; ++t)
+            workers.emplace_back(work, t);
+    } catch(...){
+        // a thread could not be started: the ranges are shared by the threads already running and this one
+    }
+    work(0);
+    for(auto& w : workers)
+        w.join();
+    for(auto& e : errors)
+        if(e) std::rethrow_exception(e);
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class F>
+void BST<TK, TV, B, A, C, S>::parallel_for_each(F f, unsigned threads) const
+{
+    const std::vector<Range> ranges = subranges(8 * std::max(1u, threads));
+    visitRanges(ranges, threads, [&](std::size_t i){
+        for(Node * n : ranges[i])
+            f(n->keyvalue);
+    });
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class T, class Map, class Reduce>
+T BST<TK, TV, B, A, C, S>::parallel_reduce(T identity, Map map, Reduce reduce, unsigned threads) const
+{
+    const std::vector<Range> ranges = subranges(8 * std::max(1u, threads));
+    std::vector<T> partial(ranges.size(), identity);
+    visitRanges(ranges, threads, [&](std::size_t i){
+        T acc = identity;
+        for(const Node * n : ranges[i])
+            acc = reduce(std::move(acc), map(n->keyvalue));
+        partial[i] = std::move(acc);
+    });
+    for(T& p : partial)
+        identity = reduce(std::move(identity), std::move(p));
+    return identity;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+TreeStats BST<TK, TV, B, A, C, S>::stats() const
+{
+    TreeStats s{};
+    recorder.read(s);
+    s.size = getSize();
+    // the depths are measured, not taken from the heights stored in the nodes
+    long long total = 0;
+    std::vector<std::pair<const Node*, int>> stack;
+    if(root) stack.emplace_back(root.get(), 1);
+    while(!stack.empty()){
+        const Node * n = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+        total += depth;
+        if(depth > s.height) s.height = depth;
+        if(n->left) stack.emplace_back(n->left.get(), depth + 1);
+        if(n->right) stack.emplace_back(n->right.get(), depth + 1);
+    }
+    s.average_depth = s.size ? double(total) / s.size : 0.0;
+    return s;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::balance()
+{
+    std::vector<Node*> v{flatten()};
+    root = rebuildBalancedTree(v, 0, int(v.size()) - 1, nullptr);
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::Iterator BST<TK, TV, B, A, C, S>::begin()
 { 
     if(!root) return end();
 
     return Iterator(root->leftmostdescent());
 }
 
-template <class TK,class TV>
-typename BST<TK, TV>::ConstIterator BST<TK, TV>::cbegin() const
+template <class TK,class TV,class B,class A,class C,class S>
+typename BST<TK, TV, B, A, C, S>::ConstIterator BST<TK, TV, B, A, C, S>::cbegin() const
 {
     if(!root)
     {
@@ -135,43 +978,59 @@ typename BST<TK, TV>::ConstIterator BST<TK, TV>::cbegin() const
 
 // Operators
 
-template <class TK,class TV>
-BST<TK, TV>& BST<TK, TV>::operator=(const BST& bst)
+template <class TK,class TV,class B,class A,class C,class S>
+BST<TK, TV, B, A, C, S>& BST<TK, TV, B, A, C, S>::operator=(const BST& bst)
 {
-    clear(); 
-    copy(bst.root);
+    if(this != &bst){
+        BST tmp{bst}; // if the copy throws, this tree is left untouched
+        *this = std::move(tmp);
+    }
     return *this;
 }
 
-template <class TK,class TV>
-BST<TK, TV>& BST<TK, TV>::operator=(BST&& bst) noexcept
+template <class TK,class TV,class B,class A,class C,class S>
+BST<TK, TV, B, A, C, S>& BST<TK, TV, B, A, C, S>::operator=(BST&& bst) noexcept
 {
-    root = std::move(bst.root);
+    if(this != &bst){
+        clear();
+        nodes = std::move(bst.nodes);
+        root = std::move(bst.root);
+        comp = std::move(bst.comp);
+    }
     return *this;
 }
 
-template <class TK,class TV>
-TV& BST<TK, TV>::operator[](const TK& key)
+template <class TK,class TV,class B,class A,class C,class S>
+template <class K, class, class>
+TV& BST<TK, TV, B, A, C, S>::operator[](const K& key)
 {
-    std::pair<TK, TV> pair{key, TV{}};
-    Iterator it{*find(key)};
-    return (*it)->keyvalue.second;
+    // a single descent, the TK is built from key only if the node is created
+    return insertNode(key, [&](Node* parent){
+        return createNode(parent, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple());
+    }).first->keyvalue.second;
 }
 
-template <class TK,class TV>
-const TV& BST<TK, TV>::operator[](const TK& key) const
+template <class TK,class TV,class B,class A,class C,class S>
+const TV& BST<TK, TV, B, A, C, S>::operator[](const TK& key) const
 {
-    std::pair<TK, TV> pair{key, TV{}};
-    ConstIterator it{*find(key)}; // dereferencing operator *
-    if (it == cend())
-    {
-        throw; // The key is not present in the tree.
-    }
-    return (*it)->keyvalue.second;
+    Node * node = findNode(key);
+    if(!node)
+        throw std::out_of_range{"The key is not present in the tree."};
+    return node->keyvalue.second;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+template <class K, class, class>
+const TV& BST<TK, TV, B, A, C, S>::operator[](const K& key) const
+{
+    Node * node = findNode(key);
+    if(!node)
+        throw std::out_of_range{"The key is not present in the tree."};
+    return node->keyvalue.second;
 }
 
-template <class TK,class TV>
-std::string BST<TK, TV>::getKeyString(int index, std::string (&f)(TK), std::string null_str ) const//= "XXX"
+template <class TK,class TV,class B,class A,class C,class S>
+std::string BST<TK, TV, B, A, C, S>::getKeyString(int index, std::string (&f)(TK), std::string null_str ) const//= "XXX"
 {
     Node * current = root.get();
     int mask = 1;
@@ -188,23 +1047,194 @@ std::string BST<TK, TV>::getKeyString(int index, std::string (&f)(TK), std::stri
     return null_str;
 }
 
-template <class TK,class TV>
-void BST<TK, TV>::printStructure(std::string (&f)(TK), std::string null_str, char empty ) const// = "XXX" = ' '
+template <class TK,class TV,class B,class A,class C,class S>
+void BST<TK, TV, B, A, C, S>::printStructure(std::string (&f)(TK), std::string null_str, char empty ) const// = "XXX" = ' '
 {
-    int elements = 1;
-    elements = elements << height;
-    int newline = 1;
-    int space_index = height-1; // at each layer the space between nodes changes
+    const int height = getHeight();
+    if(!height){
+        std::cout << "The tree is empty!" << std::endl;
+        return;
+    }
+    if(height > 20){ // the grid would be millions of characters wide
+        exportStructure(std::cout, ExportFormat::level_order, f);
+        return;
+    }
+    // one level at a time, empty positions included: every position costs O(1), not a descent from the root
+    std::vector<const Node*> level{root.get()}, next;
+    for(int space_index = height-1; space_index >= 0; --space_index){ // at each layer the space between nodes changes
+        std::cout << std::string( (1<<space_index) - 1, empty);
+        next.clear();
+        for(const Node* n : level){
+            std::cout << (n ? f(n->keyvalue.first) : null_str) << std::string( ( (1 << (space_index+1) ) - 1) , empty);
+            if(space_index){
+                next.push_back(n ? n->left.get() : nullptr);
+                next.push_back(n ? n->right.get() : nullptr);
+            }
+        }
+        std::cout << std::endl;
+        level.swap(next);
+    }
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+std::string BST<TK, TV, B, A, C, S>::escaped(const std::string& s)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string e;
+    e.reserve(s.size());
+    for(char c : s){
+        if(c == '"' || c == '\\'){
+            e += '\\';
+            e += c;
+        } else if(static_cast<unsigned char>(c) < 0x20){
+            e += "\\u00";
+            e += hex[(c >> 4) & 0xf];
+            e += hex[c & 0xf];
+        } else
+            e += c;
+    }
+    return e;
+}
+
+template <class TK,class TV,class B,class A,class C,class S>
+std::ostream& BST<TK, TV, B, A, C, S>::exportStructure(std::ostream& os, ExportFormat format, std::string (&key_format)(TK),
+                                                      std::string (*value_format)(TV), int max_depth, int max_nodes) const
+{
+    auto label = [&](const Node* n, const char* separator){
+        std::string l = key_format(n->keyvalue.first);
+        if(value_format) l += separator + value_format(n->keyvalue.second);
+        return l;
+    };
+    auto count = [](const Node* n){ return n ? n->count : 0; };
+    int written = 0;
+
+    if(format == ExportFormat::level_order){
+        // writes the token of a child at depth, returns true if the node was written and its children come next
+        auto token = [&](const Node* n, int depth){
+            if(!n){
+                os << '#';
+                return false;
+            }
+            if((max_depth >= 0 && depth > max_depth) || (max_nodes >= 0 && written >= max_nodes)){
+                os << '+' << n->count;
+                return false;
+            }
+            os << label(n, ":");
+            ++written;
+            return true;
+        };
+        std::vector<const Node*> level, next;
+        if(token(root.get(), 0))
+            level.push_back(root.get());
+        os << '\n';
+        for(int depth = 1; !level.empty(); ++depth){
+            next.clear();
+            const char* separator = "";
+            for(const Node* n : level)
+                for(const Node* child : {n->left.get(), n->right.get()}){
+                    os << separator;
+                    separator = " ";
+                    if(token(child, depth))
+                        next.push_back(child);
+                }
+            os << '\n';
+            level.swap(next);
+        }
+        return os;
+    }
 
-    std::cout<<std::string( (1<<space_index) - 1, empty);
+    const bool dot = format == ExportFormat::dot;
+    if(dot)
+        os << "digraph BST {\n";
+    else
+        os << "{\"size\": " << getSize() << ", \"height\": " << getHeight() << ", \"nodes\": [";
+    auto child_id = [&](int id, int parent, bool left){
+        if(dot)
+            os << "    n" << parent << (left ? ":sw" : ":se") << " -> n" << id << ";\n";
+        else
+            os << id;
+    };
+    auto hidden = [&](const Node* n, int id, int parent, bool left){ // a child cut by max_depth
+        if(!n) return;
+        if(dot){
+            os << "    n" << id << " [shape=box, label=\"+" << n->count << "\"];\n";
+            child_id(id, parent, left);
+        } else
+            os << ",\n    {\"id\": " << id << ", \"hidden\": " << n->count << "}";
+    };
 
-    for(int iii = 1;iii<elements;iii++){
-        std::cout << getKeyString(iii, f, null_str) << std::string( ( (1 << (space_index+1) ) - 1) , empty);
+    // preorder through the parent pointers: the left child of node id is id+1, the right one id+1+(size of the left subtree)
+    bool truncated = false;
+    const Node* n = root.get();
+    int id = 0, depth = 0;
+    while(n){
+        if(max_nodes >= 0 && written == max_nodes){
+            truncated = true;
+            break;
+        }
+        const Node* p = n->parent;
+        const Node* l = n->left.get();
+        const Node* r = n->right.get();
+        const int right_id = id + 1 + count(l);
+        if(dot){
+            os << "    n" << id << " [label=\"" << escaped(label(n, ": ")) << "\"];\n";
+            if(p)
+                child_id(id, p->left.get() == n ? id - 1 : id - 1 - count(p->left.get()), p->left.get() == n);
+        } else {
+            os << (written ? ",\n    " : "\n    ") << "{\"id\": " << id << ", \"key\": \"" << escaped(key_format(n->keyvalue.first)) << "\"";
+            if(value_format)
+                os << ", \"value\": \"" << escaped(value_format(n->keyvalue.second)) << "\"";
+            os << ", \"size\": " << n->count << ", \"left\": ";
+            if(l) child_id(id + 1, id, true); else os << "null";
+            os << ", \"right\": ";
+            if(r) child_id(right_id, id, false); else os << "null";
+            os << "}";
+        }
+        ++written;
 
-        if(iii==newline){
-            if(space_index) space_index--;
-            std::cout<<std::endl<<std::string( (1<<space_index) - 1, empty);
-            newline = (newline<<1)+1;
+        const bool deeper = max_depth < 0 || depth < max_depth;
+        if(!deeper){
+            hidden(l, id + 1, id, true);
+            hidden(r, right_id, id, false);
+        }
+        if(deeper && l){
+            n = l;
+            ++id;
+            ++depth;
+            continue;
+        }
+        if(deeper && r){
+            n = r;
+            id = right_id;
+            ++depth;
+            continue;
+        }
+        // up to the first ancestor reached from its left child that has a right child, then to that right child
+        while(n){
+            p = n->parent;
+            if(!p){
+                n = nullptr;
+                break;
+            }
+            if(p->left.get() == n){
+                if(p->right){
+                    id += n->count;
+                    n = p->right.get();
+                    break;
+                }
+                id -= 1;
+            } else
+                id -= 1 + count(p->left.get());
+            n = p;
+            --depth;
         }
     }
+
+    if(dot){
+        if(truncated)
+            os << "    // truncated after " << written << " nodes\n";
+        os << "}\n";
+    } else
+        os << "\n], \"truncated\": " << (truncated ? "true" : "false") << "}\n";
+    return os;
 }
@@ -10,8 +10,8 @@
 /**
  * @brief A template node of the template binary search tree with two children nodes and one parent node.
  */
-template <class TK,class TV>
-struct BST<TK, TV>::Node
+template <class TK,class TV,class B,class A,class C,class S>
+struct BST<TK, TV, B, A, C, S>::Node
 {
 	/** Key-value pair of the node. 
 	 * Const was added to the key to ensure tree consistency.
@@ -19,11 +19,15 @@ struct BST<TK, TV>::Node
 	std::pair<const TK, TV> keyvalue;
 
 	/** Node's left child node (child with lower key). */
-	std::unique_ptr<Node> left;
+	NodePtr left;
 	/** Node's right child node (child with larger key). */
-	std::unique_ptr<Node> right;
+	NodePtr right;
 	/** Node's parent node. */
 	Node * parent;
+	/** Number of generations of the subtree rooted in this node (1 for a leaf). */
+	int height;
+	/** Number of nodes of the subtree rooted in this node, the node included. */
+	int count;
 	
 	/**
 	 * @brief Default constructor of node
@@ -33,41 +37,61 @@ struct BST<TK, TV>::Node
 	 * @brief Construct a new Node with a given key-value pair but without parent and childrens.
 	 * @param kv The key-value to be inserted into the node.
 	 */
-	Node(std::pair<TK, TV> kv): keyvalue{kv}, left{nullptr}, right{nullptr}, parent{nullptr} {}
+	Node(std::pair<TK, TV> kv): keyvalue{std::move(kv)}, left{nullptr}, right{nullptr}, parent{nullptr}, height{1}, count{1} {}
 	/**
 	 * @brief Construct a new Node object with a given key-value pair and a parent.
 	 * @param kv The key-value to be inserted into the node.
 	 * @param p The parent of the node to be constructed.
 	 */
-	Node(std::pair<TK, TV> kv, Node* p) : keyvalue{kv}, left{nullptr}, right{nullptr}, parent{p} {}
+	Node(std::pair<TK, TV> kv, Node* p) : keyvalue{std::move(kv)}, left{nullptr}, right{nullptr}, parent{p}, height{1}, count{1} {}
+	/**
+	 * @brief Construct a new Node object with a parent, building the key-value pair in place.
+	 * @param p The parent of the node to be constructed.
+	 * @param args The arguments forwarded to the constructor of the key-value pair.
+	 */
+	template <class... Args>
+	Node(Node* p, Args&&... args) : keyvalue(std::forward<Args>(args)...), left{nullptr}, right{nullptr}, parent{p}, height{1}, count{1} {}
 	/**
 	 * @brief Copy constructor for Node class.
 	 * @param n The node to be copied.
 	 */
-	Node(const Node& n) : keyvalue{n.keyvalue}, left{nullptr}, right{nullptr}, parent{n.parent} {}
+	Node(const Node& n) : keyvalue{n.keyvalue}, left{nullptr}, right{nullptr}, parent{n.parent}, height{1}, count{1} {}
 	/**
 	 * @brief default destructor
 	 */
 	~Node() = default;
 
 	/**
-	 * @brief  Utility recursive function that returns a pointer to the lestmost node, i.e., the node with the lowest key.
+	 * @brief Recomputes the height and the count of the node from those of its children.
+	 */
+	void update() noexcept {
+		int lh = left ? left->height : 0;
+		int rh = right ? right->height : 0;
+		height = 1 + (lh > rh ? lh : rh);
+		count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+	}
+
+	/**
+	 * @brief  Utility function that returns a pointer to the lestmost node of the subtree, i.e., the node with the lowest key.
+	 *
+	 * It is a plain loop: the stack does not grow with the height of the tree.
 	 */
 	Node* leftmostdescent() noexcept {
-		if(left) return left->leftmostdescent();
-		return this;
+		Node* n = this;
+		while(n->left) n = n->left.get();
+		return n;
 	}
 	/**
-	 * @brief  Utility recursive function that returns a pointer to first right ancestor. 
+	 * @brief  Utility function that returns a pointer to first right ancestor. 
 
 	 If the current node is the left child of its parent it returns parent, otherwise it checks wheter parent is a left child of its own parent.
 	 The procedure terminates when an ancestor is found to be the left child of its own parent, otherwise a nullptr is returned.
+	 As leftmostdescent, it is a loop and does not use the stack.
 	 */
 	Node* firstrightancestor() noexcept {
-		if(parent)
-			if(parent->right.get()==this)
-				return parent->firstrightancestor();
-		return parent;
+		Node* n = this;
+		while(n->parent && n->parent->right.get() == n) n = n->parent;
+		return n->parent;
 	}
 
 };
@@ -75,11 +99,11 @@ struct BST<TK, TV>::Node
 /**
  * @brief An iterator for the BST class.
  */
-template <class TK,class TV>
-class BST<TK, TV>::Iterator
+template <class TK,class TV,class B,class A,class C,class S>
+class BST<TK, TV, B, A, C, S>::Iterator
 {
 	/** Alias to make the notation easier */
-	using Node = BST<TK, TV>::Node;
+	using Node = BST<TK, TV, B, A, C, S>::Node;
 
 private:
 	/** The node to which the iterator is currently referring. */
@@ -100,7 +124,7 @@ public:
 	 * @brief Operator ++it to advance the iterator to the successive node.
 	 * @return Iterator& Returns a reference to an iterator pointing on the next node.
 
-	 The method uses two recursive utility functions of Node: leftmostdescent and firstrightancestor.
+	 The method uses two stackless utility functions of Node: leftmostdescent and firstrightancestor.
 	 */
 	Iterator& operator++(){
 		if(_n){
@@ -136,17 +160,57 @@ public:
 	bool operator!=(const Iterator& it){return _n != it._n;}
 };
 
+/**
+ * @brief A range of nodes of the BST class, from a first node included to a last node excluded.
+ */
+template <class TK,class TV,class B,class A,class C,class S>
+class BST<TK, TV, B, A, C, S>::Range
+{
+	/** Iterator to the first node of the range. */
+	Iterator _first;
+	/** Iterator past the last node of the range. */
+	Iterator _last;
+	/** Number of nodes of the range, negative if unknown. */
+	int _size;
+
+public:
+	/**
+	 * @brief Construct a range given its delimiting iterators.
+	 * @param first Iterator to the first node.
+	 * @param last Iterator past the last node.
+	 * @param size Number of nodes of the range, if known.
+	 */
+	Range(Iterator first, Iterator last, int size = -1) : _first{first}, _last{last}, _size{size} {}
+	/**
+	 * @brief Returns the number of nodes of the range, counting them only if the range was built without its size.
+	 */
+	int size() const {
+		if(_size >= 0) return _size;
+		int n = 0;
+		for(Iterator it = _first; it != _last; ++it) ++n;
+		return n;
+	}
+	/**
+	 * @brief Used to begin an iteration on the range.
+	 */
+	Iterator begin() const { return _first; }
+	/**
+	 * @brief Used to end an iteration on the range.
+	 */
+	Iterator end() const { return _last; }
+};
+
 /**
  * @brief A constant iterator for the BST class.
  * 
  * The only difference with a normal iterator, from which it inherits, is the deferencing operator.
  */
-template <class TK,class TV>
-class BST<TK,TV>::ConstIterator : 
-public BST<TK,TV>::Iterator
+template <class TK,class TV,class B,class A,class C,class S>
+class BST<TK, TV, B, A, C, S>::ConstIterator : 
+public BST<TK, TV, B, A, C, S>::Iterator
 {
 	/** Alias to make the notation easier */
-	using Iterator = BST<TK, TV>::Iterator;
+	using Iterator = BST<TK, TV, B, A, C, S>::Iterator;
 
 public:
 	/** Uses the same method of the base class. */
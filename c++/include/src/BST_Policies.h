@@ -0,0 +1,488 @@
+/**
+ * @file BST_Policies.h
+ * @author Francesca Cairoli
+ * @date 17 June 2019
+ * @brief Header containing the policy classes that can be plugged into the BST class.
+ *
+ * The policies only rely on the public members of the BST node (left, right, parent, height and update()),
+ * so they can be written outside of the BST class and selected through its template parameters.
+ */
+
+#include <memory> // needed for unique and shared pointers
+#include <utility> // needed for std::move
+#include <type_traits> // needed for std::aligned_storage
+#include <vector>
+#include <new> // needed for placement new
+#include <atomic> // needed for the counters of CountingStats
+#include <cstddef> // needed for std::size_t
+#include <initializer_list> // needed to reset the counters in a loop
+#include <unordered_set> // needed to share the blocks of a pool only once
+
+#ifndef BST_POLICIES_H__
+#define BST_POLICIES_H__
+
+/**
+ * @brief Balancing policy which keeps the plain binary search tree behaviour.
+ *
+ * Nodes are never rotated: the shape of the tree depends on the insertion order and balance() has to be called explicitly.
+ */
+struct NoBalancing
+{
+	/** The tree does not rebalance itself on insertion. */
+	static const bool self_balancing = false;
+
+	/**
+	 * @brief Does nothing, the subtree is left as it is.
+	 * @param slot The owning pointer of the subtree root.
+	 */
+	template <class NodePtr>
+	static void rebalance(NodePtr& slot) noexcept { (void)slot; }
+};
+
+/**
+ * @brief Balancing policy implementing an AVL tree.
+ *
+ * After every insertion the nodes on the path to the root are checked and, whenever the heights of the two subtrees
+ * of a node differ by more than one, the subtree is rotated. The height of the tree is therefore always O(log n).
+ */
+struct AVLBalancing
+{
+	/** The tree rebalances itself on insertion. */
+	static const bool self_balancing = true;
+
+	/**
+	 * @brief Returns the height of a (possibly empty) subtree.
+	 * @param node The owning pointer of the subtree root.
+	 */
+	template <class NodePtr>
+	static int heightOf(const NodePtr& node) noexcept { return node ? node->height : 0; }
+
+	/**
+	 * @brief Left rotation of the subtree owned by slot. The right child becomes the new subtree root.
+	 * @param slot The owning pointer of the subtree root, it owns the new root after the rotation.
+	 */
+	template <class NodePtr>
+	static void rotateLeft(NodePtr& slot)
+	{
+		NodePtr x = std::move(slot);
+		NodePtr y = std::move(x->right);
+		x->right = std::move(y->left);
+		if(x->right) x->right->parent = x.get();
+		y->parent = x->parent;
+		x->parent = y.get();
+		x->update();
+		y->left = std::move(x);
+		y->update();
+		slot = std::move(y);
+	}
+
+	/**
+	 * @brief Right rotation of the subtree owned by slot. The left child becomes the new subtree root.
+	 * @param slot The owning pointer of the subtree root, it owns the new root after the rotation.
+	 */
+	template <class NodePtr>
+	static void rotateRight(NodePtr& slot)
+	{
+		NodePtr x = std::move(slot);
+		NodePtr y = std::move(x->left);
+		x->left = std::move(y->right);
+		if(x->left) x->left->parent = x.get();
+		y->parent = x->parent;
+		x->parent = y.get();
+		x->update();
+		y->right = std::move(x);
+		y->update();
+		slot = std::move(y);
+	}
+
+	/**
+	 * @brief Restores the AVL property on the subtree owned by slot.
+	 * @param slot The owning pointer of the subtree root, whose children are assumed to be AVL trees already.
+	 *
+	 * The four classical cases (left-left, left-right, right-right, right-left) are handled with one or two rotations.
+	 */
+	template <class NodePtr>
+	static void rebalance(NodePtr& slot)
+	{
+		int diff = heightOf(slot->left) - heightOf(slot->right);
+		if(diff > 1){
+			if(heightOf(slot->left->left) < heightOf(slot->left->right))
+				rotateLeft(slot->left);
+			rotateRight(slot);
+		} else if(diff < -1){
+			if(heightOf(slot->right->right) < heightOf(slot->right->left))
+				rotateRight(slot->right);
+			rotateLeft(slot);
+		}
+	}
+};
+
+/**
+ * @brief Allocation policy in which every node is allocated on the heap on its own, with new and delete.
+ */
+struct HeapAllocation
+{
+	/** Nodes are freed one by one, the pool never owns memory by itself. */
+	static const bool bulk_release = false;
+
+	/** Deleter used by the owning pointers of the nodes. */
+	template <class T>
+	using deleter = std::default_delete<T>;
+
+	/**
+	 * @brief Trivial pool forwarding every request to new and delete.
+	 * @tparam T Type of the objects created by the pool.
+	 */
+	template <class T>
+	class pool
+	{
+	public:
+		/**
+		 * @brief Allocates and constructs a new object.
+		 * @param args The arguments forwarded to the constructor of T.
+		 */
+		template <class... Args>
+		T* create(Args&&... args) { return new T(std::forward<Args>(args)...); }
+		/**
+		 * @brief Destroys and frees an object created by this pool.
+		 * @param p The object to be destroyed.
+		 */
+		void destroy(T* p) noexcept { delete p; }
+		/**
+		 * @brief Nothing to release: every object was freed by destroy or by its owning pointer.
+		 */
+		void release() noexcept {}
+		/**
+		 * @brief Nothing to share: the objects created by another pool can be destroyed by this one.
+		 * @param p The other pool.
+		 */
+		void share(const pool& p) noexcept { (void)p; }
+	};
+};
+
+/**
+ * @brief Allocation policy in which the nodes are carved out of large contiguous blocks owned by the tree.
+ *
+ * Nodes inserted one after the other end up adjacent in memory, and clear() gives back whole blocks at once.
+ * The owning pointers of the nodes only call the destructor of the node, the memory is returned when the pool is released.
+ * The blocks are reference counted: when trees exchange nodes (split, join, set operations) their pools share the blocks,
+ * which are freed when the last pool using them is released.
+ */
+struct ArenaAllocation
+{
+	/** The pool owns the memory of the nodes and frees it block by block. */
+	static const bool bulk_release = true;
+
+	/**
+	 * @brief Deleter used by the owning pointers of the nodes: it destroys the node but does not free its memory.
+	 * @tparam T Type of the objects to be destroyed.
+	 */
+	template <class T>
+	struct deleter
+	{
+		/**
+		 * @brief Calls the destructor of the object.
+		 * @param p The object to be destroyed.
+		 */
+		void operator()(T* p) const noexcept { p->~T(); }
+	};
+
+	/**
+	 * @brief Bump allocator over a list of blocks of geometrically increasing size, with a free list for reuse.
+	 * @tparam T Type of the objects created by the pool.
+	 */
+	template <class T>
+	class pool
+	{
+		/** Raw, correctly aligned storage for one object. */
+		union Slot
+		{
+			/** Next free slot when the slot is in the free list. */
+			Slot* next;
+			/** Storage of the object. */
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		};
+
+		/** Number of slots of the first block. */
+		static const std::size_t first_block = 64;
+		/** Maximum number of slots of a block. */
+		static const std::size_t max_block = std::size_t{1} << 16;
+
+		/** Blocks owned by the pool, possibly together with other pools. */
+		std::vector<std::shared_ptr<Slot>> blocks;
+		/** Next unused slot of the last block. */
+		Slot* next;
+		/** One past the last slot of the last block. */
+		Slot* last;
+		/** Number of slots of the last block. */
+		std::size_t block_size;
+		/** Slots given back by destroy, reused before carving new ones. */
+		Slot* free_list;
+
+		/**
+		 * @brief Allocates a new block, twice as large as the previous one.
+		 */
+		void grow()
+		{
+			if(!block_size) block_size = first_block;
+			else if(block_size < max_block) block_size *= 2;
+			blocks.emplace_back(new Slot[block_size], std::default_delete<Slot[]>());
+			next = blocks.back().get();
+			last = next + block_size;
+		}
+
+	public:
+		/**
+		 * @brief Builds an empty pool, no memory is allocated until the first object is created.
+		 */
+		pool() noexcept : next{nullptr}, last{nullptr}, block_size{0}, free_list{nullptr} {}
+		/**
+		 * @brief Move constructor, the blocks are taken from p which is left empty.
+		 * @param p The pool to be moved.
+		 */
+		pool(pool&& p) noexcept : blocks{std::move(p.blocks)}, next{p.next}, last{p.last}, block_size{p.block_size}, free_list{p.free_list}
+		{
+			p.blocks.clear();
+			p.next = p.last = p.free_list = nullptr;
+			p.block_size = 0;
+		}
+		/**
+		 * @brief Move assignment, the blocks owned by this pool are released.
+		 * @param p The pool to be moved.
+		 */
+		pool& operator=(pool&& p) noexcept
+		{
+			blocks = std::move(p.blocks);
+			next = p.next; last = p.last; block_size = p.block_size; free_list = p.free_list;
+			p.blocks.clear();
+			p.next = p.last = p.free_list = nullptr;
+			p.block_size = 0;
+			return *this;
+		}
+
+		/**
+		 * @brief Constructs a new object in the first free slot.
+		 * @param args The arguments forwarded to the constructor of T.
+		 */
+		template <class... Args>
+		T* create(Args&&... args)
+		{
+			Slot* s = free_list;
+			if(s) free_list = s->next;
+			else{
+				if(next == last) grow();
+				s = next++;
+			}
+			return new (&s->storage) T(std::forward<Args>(args)...);
+		}
+		/**
+		 * @brief Destroys an object and puts its slot in the free list.
+		 * @param p The object to be destroyed.
+		 */
+		void destroy(T* p) noexcept
+		{
+			p->~T();
+			Slot* s = reinterpret_cast<Slot*>(p);
+			s->next = free_list;
+			free_list = s;
+		}
+		/**
+		 * @brief Frees all the blocks at once. The objects must have been destroyed (or be trivially destructible).
+		 *
+		 * The blocks shared with other pools are freed only when those pools release them too.
+		 */
+		void release() noexcept
+		{
+			blocks.clear();
+			next = last = free_list = nullptr;
+			block_size = 0;
+		}
+		/**
+		 * @brief Takes a share of all the blocks of p, so that the objects created by p can be kept and destroyed by this pool.
+		 * @param p The other pool, it keeps its blocks.
+		 */
+		void share(const pool& p)
+		{
+			if(&p == this) return;
+			// trees splitting and joining again share the same blocks many times: each block is kept once
+			std::unordered_set<const Slot*> owned;
+			for(const auto& b : blocks) owned.insert(b.get());
+			blocks.reserve(blocks.size() + p.blocks.size());
+			for(const auto& b : p.blocks)
+				if(owned.insert(b.get()).second)
+					blocks.push_back(b);
+		}
+	};
+};
+
+/**
+ * @brief Snapshot of the statistics of a tree, returned by BST::stats().
+ *
+ * The counters are zero with the NoStats policy; size, height and average depth are always measured on the tree.
+ */
+struct TreeStats
+{
+	/** Number of buckets of the depth histogram, the last one counts the lookups at that depth or deeper. */
+	static const int depth_buckets = 64;
+	/** Number of lookups (find, operator[], erase). */
+	unsigned long long finds;
+	/** Key comparisons made by the lookups. */
+	unsigned long long find_comparisons;
+	/** Number of insertions, including the ones finding the key already present. */
+	unsigned long long inserts;
+	/** Key comparisons made by the insertions. */
+	unsigned long long insert_comparisons;
+	/** depth_histogram[d] is the number of lookups that visited d nodes (0 for an empty tree). */
+	unsigned long long depth_histogram[depth_buckets];
+	/** Number of nodes created by the tree. */
+	unsigned long long allocations;
+	/** Number of nodes destroyed by the tree. */
+	unsigned long long frees;
+	/** Bytes of the nodes created by the tree. */
+	unsigned long long bytes_allocated;
+	/** Bytes of the nodes destroyed by the tree. */
+	unsigned long long bytes_freed;
+	/** Number of nodes of the tree. */
+	int size;
+	/** Height of the tree, measured by visiting it. */
+	int height;
+	/** Average number of nodes from the root to a node, root included (0 for an empty tree). */
+	double average_depth;
+};
+
+/**
+ * @brief Statistics policy recording nothing: every hook is empty and the compiler removes the calls and their arguments.
+ */
+struct NoStats
+{
+	/** The tree does not record statistics. */
+	static const bool enabled = false;
+
+	/**
+	 * @brief Called after a lookup.
+	 * @param depth Number of nodes visited.
+	 * @param comparisons Number of key comparisons.
+	 */
+	void find(int depth, int comparisons) const noexcept { (void)depth; (void)comparisons; }
+	/**
+	 * @brief Called after an insertion.
+	 * @param comparisons Number of key comparisons.
+	 */
+	void insert(int comparisons) const noexcept { (void)comparisons; }
+	/**
+	 * @brief Called when nodes are created.
+	 * @param count Number of nodes.
+	 * @param bytes Bytes of one node.
+	 */
+	void allocated(std::size_t count, std::size_t bytes) const noexcept { (void)count; (void)bytes; }
+	/**
+	 * @brief Called when nodes are destroyed.
+	 * @param count Number of nodes.
+	 * @param bytes Bytes of one node.
+	 */
+	void freed(std::size_t count, std::size_t bytes) const noexcept { (void)count; (void)bytes; }
+	/**
+	 * @brief Copies the counters into a snapshot: there is nothing to copy.
+	 */
+	void read(TreeStats& s) const noexcept { (void)s; }
+	/**
+	 * @brief Sets the counters to zero: there is nothing to reset.
+	 */
+	void reset() const noexcept {}
+};
+
+/**
+ * @brief Statistics policy counting comparisons, lookup depths and node allocations.
+ *
+ * The counters are relaxed atomics, so lookups running concurrently on a constant tree (e.g. through ConcurrentBST)
+ * can record them; each hook costs a few atomic increments.
+ */
+class CountingStats
+{
+	/** Counters in the order of the fields of TreeStats. */
+	std::atomic<unsigned long long> finds, find_comparisons, inserts, insert_comparisons;
+	/** Lookup depth histogram. */
+	std::atomic<unsigned long long> depth_histogram[TreeStats::depth_buckets];
+	/** Allocation counters. */
+	std::atomic<unsigned long long> allocations, frees, bytes_allocated, bytes_freed;
+
+	/**
+	 * @brief Adds n to a counter.
+	 */
+	static void add(std::atomic<unsigned long long>& c, unsigned long long n) noexcept { c.fetch_add(n, std::memory_order_relaxed); }
+	/**
+	 * @brief Reads a counter.
+	 */
+	static unsigned long long get(const std::atomic<unsigned long long>& c) noexcept { return c.load(std::memory_order_relaxed); }
+
+public:
+	/** The tree records statistics. */
+	static const bool enabled = true;
+
+	/**
+	 * @brief All the counters start from zero.
+	 */
+	CountingStats() noexcept { reset(); }
+
+	/**
+	 * @brief See NoStats::find.
+	 */
+	void find(int depth, int comparisons) noexcept
+	{
+		add(finds, 1);
+		add(find_comparisons, unsigned(comparisons));
+		add(depth_histogram[depth < TreeStats::depth_buckets ? depth : TreeStats::depth_buckets - 1], 1);
+	}
+	/**
+	 * @brief See NoStats::insert.
+	 */
+	void insert(int comparisons) noexcept
+	{
+		add(inserts, 1);
+		add(insert_comparisons, unsigned(comparisons));
+	}
+	/**
+	 * @brief See NoStats::allocated.
+	 */
+	void allocated(std::size_t count, std::size_t bytes) noexcept
+	{
+		add(allocations, count);
+		add(bytes_allocated, count * bytes);
+	}
+	/**
+	 * @brief See NoStats::freed.
+	 */
+	void freed(std::size_t count, std::size_t bytes) noexcept
+	{
+		add(frees, count);
+		add(bytes_freed, count * bytes);
+	}
+	/**
+	 * @brief Copies the counters into a snapshot.
+	 */
+	void read(TreeStats& s) const noexcept
+	{
+		s.finds = get(finds);
+		s.find_comparisons = get(find_comparisons);
+		s.inserts = get(inserts);
+		s.insert_comparisons = get(insert_comparisons);
+		for(int i = 0; i < TreeStats::depth_buckets; ++i)
+			s.depth_histogram[i] = get(depth_histogram[i]);
+		s.allocations = get(allocations);
+		s.frees = get(frees);
+		s.bytes_allocated = get(bytes_allocated);
+		s.bytes_freed = get(bytes_freed);
+	}
+	/**
+	 * @brief Sets all the counters to zero.
+	 */
+	void reset() noexcept
+	{
+		for(auto* c : {&finds, &find_comparisons, &inserts, &insert_comparisons, &allocations, &frees, &bytes_allocated, &bytes_freed})
+			c->store(0, std::memory_order_relaxed);
+		for(auto& c : depth_histogram)
+			c.store(0, std::memory_order_relaxed);
+	}
+};
+
+#endif //BST_POLICIES_H__
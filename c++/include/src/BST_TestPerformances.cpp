@@ -6,52 +6,121 @@
  */
 
 #include "BST.h"
+#include "BST_Concurrent.h"
+#include "BST_BTree.h"
 #include <memory>
 #include <algorithm>
 #include <string>
 #include <vector>
 #include <cstdlib>
+#include <cstdio>
+#include <cstddef>
+#include <new>
 #include <cmath>
 #include <map>
 #include <unordered_map>
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 using namespace std;
 
+// Every heap allocation of the program goes through this operator new, so that the string-key test
+// can report the number of allocations per operation and the B-tree test the bytes in use per element.
+// The size of each block is kept in a header in front of it, to be subtracted when the block is freed.
+// Every form of new and delete is replaced, so that each block freed here was allocated with the header.
+std::atomic<long long> allocations{0};
+std::atomic<long long> live_bytes{0};
+const std::size_t block_header = alignof(std::max_align_t);
+
+void* allocate_block(std::size_t n) noexcept {
+	allocations++;
+	char* p = static_cast<char*>(std::malloc(n + block_header));
+	if(!p) return nullptr;
+	*reinterpret_cast<std::size_t*>(p) = n;
+	live_bytes += (long long)n;
+	return p + block_header;
+}
+void free_block(void* p) noexcept {
+	if(!p) return;
+	char* block = static_cast<char*>(p) - block_header;
+	live_bytes -= (long long)*reinterpret_cast<std::size_t*>(block);
+	std::free(block);
+}
+
+void* operator new(std::size_t n){
+	if(void* p = allocate_block(n)) return p;
+	throw std::bad_alloc{};
+}
+void* operator new[](std::size_t n){ return operator new(n); }
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return allocate_block(n); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return allocate_block(n); }
+void operator delete(void* p) noexcept { free_block(p); }
+void operator delete[](void* p) noexcept { free_block(p); }
+void operator delete(void* p, std::size_t) noexcept { free_block(p); }
+void operator delete[](void* p, std::size_t) noexcept { free_block(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free_block(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free_block(p); }
+
 int N_max=25000; 
 
+volatile long long lookup_sink; // keeps the compiler from dropping the lookups
+
 // Test number one:
 // Define two BST of int and float respectively and measure the time required to find N different elements in a BST of size N.
 // Results are printed on a file. 
 
 template<class T>
-void measure_lookups_time(T bst,ofstream& results_file){
+void measure_lookups_time(const T& bst,ofstream& results_file){
         results_file <<"N   total time    time per operation   Log(N)"<<endl;
         for(int j=0;j<N_max;j+=50){
+            long long hits = 0;
             auto start_timer = chrono::high_resolution_clock::now();
             for(int i=0;i<j;++i){
-                bst.find(i);
+                hits += (bst.find(i) != bst.end());
                 }
         auto end_timer = chrono::high_resolution_clock::now();
+        lookup_sink = hits;
         auto global_time = chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
         results_file << j << "        " << global_time << "         " << global_time/double(j) << "       " << log2(global_time/double(j)) <<endl;
         }
 
 };
 
+// The same lookups are also done in a single batch with find_many, both in the original order and sorted.
+
 template<class T, typename Y>
-void measure_lookups_time_from_vect(T bst,ofstream& results_file, std::vector<Y>& val){
-        results_file <<"N   total time    time per operation   Log(N)"<<endl;
+void measure_lookups_time_from_vect(const T& bst,ofstream& results_file, std::vector<Y>& val){
+        results_file <<"N   total time    time per operation   Log(N)   batched total time   batched time per operation   sorted batch total time   sorted batch time per operation"<<endl;
+        std::vector<typename T::Iterator> found(val.size(), bst.end());
         for(int j=0;j<N_max;j+=50){
+            long long hits = 0;
             auto start_timer = chrono::high_resolution_clock::now();
             for(int i=0;i<j;++i){
-                bst.find(val[i]);
+                hits += (bst.find(val[i]) != bst.end());
             }
             auto end_timer = chrono::high_resolution_clock::now();
             auto global_time = chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
-            results_file << j << "        " << global_time << "         " << global_time/double(j) << "       "<< log2(global_time/double(j)) <<endl;
+            lookup_sink = hits;
+
+            start_timer = chrono::high_resolution_clock::now();
+            bst.find_many(val.begin(), val.begin()+j, found.begin());
+            end_timer = chrono::high_resolution_clock::now();
+            auto batched_time = chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
+
+            std::vector<Y> sorted_val(val.begin(), val.begin()+j);
+            std::sort(sorted_val.begin(), sorted_val.end());
+            start_timer = chrono::high_resolution_clock::now();
+            bst.find_many(sorted_val.begin(), sorted_val.end(), found.begin());
+            end_timer = chrono::high_resolution_clock::now();
+            auto sorted_time = chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
+
+            results_file << j << "        " << global_time << "         " << global_time/double(j) << "       "<< log2(global_time/double(j))
+                << "       " << batched_time << "         " << batched_time/double(j)
+                << "       " << sorted_time << "         " << sorted_time/double(j) <<endl;
         }
 
 };
@@ -64,7 +133,7 @@ void compare_different_types(string type){
 		BST<int,int> bst;
         std::vector<int> val;
         for(int i=0; i<N_max; ++i){
-            int x = ( rand() / RAND_MAX) * (100 - 1) + 1;
+            int x = int(((double) rand() / RAND_MAX) * (100*N_max - 1) + 1); // floating division, the keys are spread over [1, 100*N_max]
             pair<int, int> pair{x,x};
             bst.insert(pair);
             val.push_back(x);
@@ -92,7 +161,7 @@ void compare_different_types(string type){
 };
 
 // Test number two:
-// Compare the performances of unbalanced BST, balanced BST, map and unordered_map.
+// Compare the performances of unbalanced BST, balanced BST, self-balancing (AVL) BST, map and unordered_map.
 
 void compare_bst_map(){
 	ofstream unbalanced_results_file;
@@ -111,6 +180,17 @@ void compare_bst_map(){
 	measure_lookups_time(bst,balanced_results_file);
 	balanced_results_file.close();
 
+	// Same sequential-key ingest, but the tree rebalances itself on every insert.
+	ofstream avl_results_file;
+	avl_results_file.open ("performance_avl.txt");
+	BST<int,int,AVLBalancing> bst_avl;
+	for(int i=0;i<N_max;++i){
+		pair<int, int> pair{i,i};
+		bst_avl.insert(pair);
+	}
+	measure_lookups_time(bst_avl, avl_results_file);
+	avl_results_file.close();
+
 	map<int,int> bst_map;
 	ofstream map_results_file;
     map_results_file.open ("performance_map.txt");
@@ -132,10 +212,365 @@ void compare_bst_map(){
     umap_results_file.close();
 };
 
+// Test number three:
+// Compare the default allocation of the nodes (one unique_ptr-owned heap allocation per node) with the arena allocation
+// (nodes carved out of large blocks owned by the tree): time to build the tree, to look up all the keys and to destroy it.
+
+template<class T>
+void measure_allocation_phases(const std::vector<int>& keys, ofstream& results_file){
+	auto start_timer = chrono::high_resolution_clock::now();
+	T* bst = new T;
+	for(int k : keys){
+		pair<int, int> pair{k,k};
+		bst->insert(pair);
+	}
+	auto end_timer = chrono::high_resolution_clock::now();
+	auto build_time = chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
+
+	long long checksum = 0; // keeps the compiler from dropping the lookups
+	start_timer = chrono::high_resolution_clock::now();
+	for(int k : keys)
+		checksum += (*bst->find(k))->keyvalue.second;
+	end_timer = chrono::high_resolution_clock::now();
+	auto lookup_time = chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
+
+	start_timer = chrono::high_resolution_clock::now();
+	delete bst;
+	end_timer = chrono::high_resolution_clock::now();
+	auto teardown_time = chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
+
+	results_file << "   " << build_time << "         " << lookup_time << "         " << teardown_time;
+	if(checksum == 0) results_file << " (empty)";
+}
+
+void compare_allocation(){
+	ofstream results_file;
+	results_file.open ("performance_allocation.txt");
+	results_file << "N   heap: build   lookup   teardown   arena: build   lookup   teardown   (microseconds)" << endl;
+	for(int n=10000;n<=1000000;n*=10){
+		std::vector<int> keys;
+		for(int i=0;i<n;++i)
+			keys.push_back(rand());
+		results_file << n << "     ";
+		measure_allocation_phases<BST<int,int,AVLBalancing,HeapAllocation>>(keys, results_file);
+		results_file << "     ";
+		measure_allocation_phases<BST<int,int,AVLBalancing,ArenaAllocation>>(keys, results_file);
+		results_file << endl;
+	}
+	results_file.close();
+};
+
+// Test number four:
+// Compare the time needed to build a tree from an existing dataset: calling insert in a loop versus the bulk-load constructor,
+// with sorted and unsorted input, sorting with one thread or with all the available cores.
+
+template<class F>
+long long measure_build_time(F build){
+	auto start_timer = chrono::high_resolution_clock::now();
+	build();
+	auto end_timer = chrono::high_resolution_clock::now();
+	return chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
+}
+
+void compare_bulk_load(){
+	ofstream results_file;
+	results_file.open ("performance_bulk_load.txt");
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	results_file << "N   sorted: insert loop   bulk   unsorted: insert loop   bulk (1 thread)   bulk (" << threads << " threads)   (microseconds)" << endl;
+	for(int n=10000;n<=1000000;n*=10){
+		std::vector<pair<int, int>> sorted_data, unsorted_data;
+		for(int i=0;i<n;++i){
+			sorted_data.push_back(pair<int, int>{i,i});
+			int x = rand();
+			unsorted_data.push_back(pair<int, int>{x,x});
+		}
+		results_file << n << "     ";
+		// the insert loop on sorted keys needs a self-balancing tree, otherwise it degenerates into a list
+		results_file << measure_build_time([&](){ BST<int,int,AVLBalancing> bst; for(auto& p : sorted_data) bst.insert(p); }) << "     ";
+		results_file << measure_build_time([&](){ BST<int,int> bst(sorted_data.begin(), sorted_data.end()); }) << "     ";
+		results_file << measure_build_time([&](){ BST<int,int> bst; for(auto& p : unsorted_data) bst.insert(p); }) << "     ";
+		results_file << measure_build_time([&](){ BST<int,int> bst(unsorted_data.begin(), unsorted_data.end()); }) << "     ";
+		results_file << measure_build_time([&](){ BST<int,int> bst(unsorted_data.begin(), unsorted_data.end(), threads); }) << endl;
+	}
+	results_file.close();
+};
+
+// Test number five:
+// Compare random lookups on the pointer tree (balanced), on its frozen Eytzinger snapshot, on map and on unordered_map.
+
+template<class T, class Q>
+long long measure_random_lookups(const T& container, const std::vector<Q>& queries){
+	long long found = 0;
+	auto start_timer = chrono::high_resolution_clock::now();
+	for(const Q& q : queries)
+		found += (container.find(q) != container.end());
+	auto end_timer = chrono::high_resolution_clock::now();
+	lookup_sink = found;
+	return chrono::duration_cast<chrono::microseconds>(end_timer-start_timer).count();
+}
+
+void compare_frozen(){
+	ofstream results_file;
+	results_file.open ("performance_frozen.txt");
+	results_file << "N   BST   frozen   map   unordered_map   (microseconds for N random lookups)" << endl;
+	for(int n=10000;n<=1000000;n*=10){
+		std::vector<pair<int, int>> data;
+		std::vector<int> queries;
+		for(int i=0;i<n;++i){
+			data.push_back(pair<int, int>{2*i,i});
+			queries.push_back(rand() % (2*n)); // half of the queries miss
+		}
+		BST<int,int> bst(data.begin(), data.end());
+		FrozenBST<int,int> frozen = bst.freeze();
+		map<int,int> bst_map(data.begin(), data.end());
+		unordered_map<int,int> bst_umap(data.begin(), data.end());
+		results_file << n << "     " << measure_random_lookups(bst, queries) << "     " << measure_random_lookups(frozen, queries)
+			<< "     " << measure_random_lookups(bst_map, queries) << "     " << measure_random_lookups(bst_umap, queries) << endl;
+	}
+	results_file.close();
+};
+
+// Test number six:
+// Lookup throughput of the concurrent tree with 1 to N reader threads while one writer keeps inserting,
+// compared with a plain BST protected by a global mutex.
+
+template<class Lookup, class Write>
+double measure_reader_throughput(unsigned readers, Lookup lookup, Write write){
+	std::atomic<bool> stop{false};
+	std::atomic<long long> total{0};
+	std::vector<std::thread> threads;
+	for(unsigned r=0;r<readers;++r)
+		threads.emplace_back([&, r](){
+			long long n = 0, found = 0;
+			unsigned x = 12345 + r;
+			while(!stop.load(std::memory_order_relaxed)){
+				x = x*1103515245u + 12345u;
+				found += lookup(int(x % 2000000u));
+				++n;
+			}
+			lookup_sink = found;
+			total += n;
+		});
+	std::thread writer([&](){
+		for(int i=0; !stop.load(std::memory_order_relaxed); ++i)
+			write(2000000 + i);
+	});
+	std::this_thread::sleep_for(chrono::milliseconds(500));
+	stop = true;
+	for(auto& t : threads) t.join();
+	writer.join();
+	return total / 0.5;
+}
+
+void compare_concurrent_lookups(){
+	ofstream results_file;
+	results_file.open ("performance_concurrent.txt");
+	results_file << "readers   ConcurrentBST   BST+mutex   (lookups per second, one writer inserting)" << endl;
+	std::vector<pair<int, int>> data;
+	for(int i=0;i<1000000;++i)
+		data.push_back(pair<int, int>{2*i,i});
+	unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for(unsigned readers=1;readers<=max_threads;++readers){
+		ConcurrentBST<int,int,AVLBalancing> concurrent;
+		concurrent.bulk_insert(data.begin(), data.end());
+		double concurrent_throughput = measure_reader_throughput(readers,
+			[&](int k){ int v; return concurrent.find(k, v); },
+			[&](int k){ concurrent.insert(pair<int, int>{k,k}); });
+
+		BST<int,int,AVLBalancing> bst(data.begin(), data.end());
+		std::mutex global;
+		double mutex_throughput = measure_reader_throughput(readers,
+			[&](int k){ std::lock_guard<std::mutex> lock{global}; return bst.find(k) != bst.end(); },
+			[&](int k){ std::lock_guard<std::mutex> lock{global}; bst.insert(pair<int, int>{k,k}); });
+
+		results_file << readers << "     " << concurrent_throughput << "     " << mutex_throughput << endl;
+	}
+	results_file.close();
+};
+
+// Test number seven:
+// String keys and values: allocations per operation and time when copying pairs into insert and looking up through a
+// temporary std::string, versus moving into try_emplace and looking up a const char* with a transparent comparator.
+
+template<class F>
+void measure_string_phase(const string& name, int n, F phase, ofstream& results_file){
+	long long before = allocations;
+	long long time = measure_build_time(phase);
+	results_file << name << "     " << (allocations - before) / double(n) << "     " << time << endl;
+}
+
+void compare_string_keys(){
+	ofstream results_file;
+	results_file.open ("performance_string_keys.txt");
+	const int n = 100000;
+	std::vector<string> keys, values;
+	for(int i=0;i<n;++i){
+		keys.push_back("performance_test_key_" + to_string(1000000 + rand())); // longer than the small string buffer
+		values.push_back(string(64, 'a' + i%26));
+	}
+	results_file << "operation   allocations per operation   total time (microseconds)" << endl;
+
+	BST<string,string,AVLBalancing,HeapAllocation,std::less<>> bst_copy, bst_move;
+	measure_string_phase("insert(pair) copying key and value", n, [&](){
+		for(int i=0;i<n;++i){
+			pair<string, string> pair{keys[i], values[i]};
+			bst_copy.insert(pair);
+		}
+	}, results_file);
+	std::vector<string> keys_to_move{keys}, values_to_move{values};
+	measure_string_phase("try_emplace moving key and value", n, [&](){
+		for(int i=0;i<n;++i)
+			bst_move.try_emplace(std::move(keys_to_move[i]), std::move(values_to_move[i]));
+	}, results_file);
+
+	long long found = 0;
+	measure_string_phase("find(std::string(const char*))", n, [&](){
+		for(int i=0;i<n;++i)
+			found += (bst_move.find(string(keys[i].c_str())) != bst_move.end());
+	}, results_file);
+	measure_string_phase("find(const char*), transparent", n, [&](){
+		for(int i=0;i<n;++i)
+			found += (bst_move.find(keys[i].c_str()) != bst_move.end());
+	}, results_file);
+	measure_string_phase("operator[](const char*), transparent", n, [&](){
+		for(int i=0;i<n;++i)
+			found += bst_move[keys[i].c_str()].size();
+	}, results_file);
+	lookup_sink = found;
+	results_file.close();
+};
+
+// Test number eight:
+// Full scan of a large tree: the sequential iterator versus parallel_for_each and parallel_reduce, from 1 to all the cores.
+
+void compare_parallel_scan(){
+	ofstream results_file;
+	results_file.open ("performance_parallel_scan.txt");
+	results_file << "threads   iterator   parallel_for_each   parallel_reduce   (microseconds for a scan of 4M nodes)" << endl;
+	std::vector<pair<int, int>> data;
+	for(int i=0;i<(1<<22);++i)
+		data.push_back(pair<int, int>{i,i});
+	BST<int,int> bst(data.begin(), data.end());
+	long long sum = 0;
+	long long iterator_time = measure_build_time([&](){
+		for(auto node : bst)
+			sum += node->keyvalue.second;
+	});
+	unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for(unsigned threads=1;threads<=max_threads;++threads){
+		long long for_each_time = measure_build_time([&](){
+			bst.parallel_for_each([&](pair<const int, int>& kv){ kv.second ^= 1; }, threads);
+		});
+		long long reduce_time = measure_build_time([&](){
+			sum += bst.parallel_reduce(0LL, [](const pair<const int, int>& kv){ return (long long)kv.second; },
+				[](long long a, long long b){ return a + b; }, threads);
+		});
+		results_file << threads << "     " << iterator_time << "     " << for_each_time << "     " << reduce_time << endl;
+	}
+	lookup_sink = sum;
+	results_file.close();
+};
+
+// Test number nine:
+// Startup time of a service holding a BST<int,double>: rebuilding the tree from the text written by printOrderedList
+// versus mapping the binary snapshot written by save. The first lookup is included in both.
+
+void compare_snapshot_startup(){
+	ofstream results_file;
+	results_file.open ("performance_snapshot.txt");
+	results_file << "N   text dump + insert (AVL)   text dump + bulk load   load_mapped   (microseconds, first lookup included)" << endl;
+	for(int n=10000;n<=4000000;n*=20){
+		BST<int,double> bst;
+		std::vector<pair<int, double>> data;
+		for(int i=0;i<n;++i)
+			data.push_back(pair<int, double>{rand(), i*0.5});
+		bst.bulk_insert(data.begin(), data.end());
+		{
+			ofstream dump{"snapshot_dump.txt"};
+			bst.printOrderedList(dump);
+		}
+		bst.save("snapshot.bin");
+		const int probe = data[n/2].first;
+		double found = 0;
+
+		long long insert_time = measure_build_time([&](){
+			ifstream in{"snapshot_dump.txt"};
+			BST<int,double,AVLBalancing> loaded; // the dump is sorted, a plain tree would degenerate into a list
+			int k; char colon; double v;
+			while(in >> k >> colon >> v)
+				loaded.insert(pair<int, double>{k, v});
+			found += loaded[probe];
+		});
+		long long bulk_time = measure_build_time([&](){
+			ifstream in{"snapshot_dump.txt"};
+			std::vector<pair<int, double>> pairs;
+			int k; char colon; double v;
+			while(in >> k >> colon >> v)
+				pairs.push_back(pair<int, double>{k, v});
+			BST<int,double> loaded(pairs.begin(), pairs.end());
+			found += loaded[probe];
+		});
+		long long mapped_time = measure_build_time([&](){
+			FrozenBST<int,double> loaded = BST<int,double>::load_mapped("snapshot.bin");
+			found += loaded[probe];
+		});
+		lookup_sink = (long long)found;
+		results_file << n << "     " << insert_time << "     " << bulk_time << "     " << mapped_time << endl;
+	}
+	std::remove("snapshot_dump.txt");
+	std::remove("snapshot.bin");
+	results_file.close();
+};
+
+// Test number ten:
+// Many keys per node: BTree against BST, map and unordered_map with int and double keys. For each container the time to
+// insert N random keys, the time of N random lookups (half of them miss) and the bytes in use per element.
+
+template<class T, class K>
+void measure_btree_row(const string& name, const std::vector<K>& keys, const std::vector<K>& queries, ofstream& results_file){
+	long long before = live_bytes;
+	T container;
+	long long insert_time = measure_build_time([&](){
+		for(const K& k : keys)
+			container.insert(pair<K, K>{k,k});
+	});
+	double bytes = double(live_bytes - before) / double(keys.size());
+	results_file << keys.size() << "   " << name << "     " << insert_time << "     "
+		<< measure_random_lookups(container, queries) << "     " << bytes << endl;
+}
+
+template<class K, class Draw>
+void compare_btree(const string& type, Draw draw){
+	ofstream results_file;
+	results_file.open ("performance_btree_"+type+".txt");
+	results_file << "N   container   insert   lookup   (microseconds)   bytes per element" << endl;
+	for(int n=10000;n<=1000000;n*=10){
+		std::vector<K> keys, queries;
+		for(int i=0;i<n;++i)
+			keys.push_back(draw());
+		for(int i=0;i<n;++i)
+			queries.push_back(i%2 ? keys[rand()%n] : draw());
+		measure_btree_row<BST<K,K>>("BST", keys, queries, results_file);
+		measure_btree_row<BTree<K,K>>("BTree", keys, queries, results_file);
+		measure_btree_row<map<K,K>>("map", keys, queries, results_file);
+		measure_btree_row<unordered_map<K,K>>("unordered_map", keys, queries, results_file);
+	}
+	results_file.close();
+};
+
 int main(){
 	
 	compare_different_types("int");
 	compare_different_types("double");
 	compare_bst_map();
+	compare_allocation();
+	compare_bulk_load();
+	compare_frozen();
+	compare_concurrent_lookups();
+	compare_string_keys();
+	compare_parallel_scan();
+	compare_snapshot_startup();
+	compare_btree<int>("int", [](){ return rand(); });
+	compare_btree<double>("double", [](){ return (double) rand() / RAND_MAX * 100.; });
 	return 0;
 };
\ No newline at end of file
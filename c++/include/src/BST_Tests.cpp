@@ -5,6 +5,16 @@
  * @brief Source file to perform various tests on the BST class.
  */
 #include "BST.h"
+#include "BST_Concurrent.h"
+#include "BST_BTree.h"
+#include <string>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 
 
 int main()
@@ -92,6 +102,285 @@ int main()
         std::cout << bst_1 << std::endl;
         std::cout << bst << std::endl;
 
+        // Testing the self-balancing AVL policy: sequential keys would build a linked list in a plain BST
+        std::cout << "Testing the AVL balancing policy" << std::endl;
+        BST<int,int,AVLBalancing> avl{};
+        for(int i=1; i<=15; ++i)
+                avl.insert(std::pair<int,int>{i,i});
+        avl.insert(std::pair<int,int>{8,80}); // overwrite, the size must not change
+        std::cout << avl << std::endl;
+        std::cout << "Size: " << avl.getSize() << ", height: " << avl.getHeight() << std::endl;
+        avl.printStructure(std::to_string, "-", ' ');
+
+        // Testing the arena allocation policy: nodes come from blocks owned by the tree
+        std::cout << "Testing the arena allocation policy" << std::endl;
+        BST<int,std::string,AVLBalancing,ArenaAllocation> arena{};
+        for(int i=0; i<10; ++i)
+                arena.insert(std::pair<int,std::string>{i, std::to_string(i*i)});
+        BST<int,std::string,AVLBalancing,ArenaAllocation> arena_copy = arena;
+        arena.clear();
+        std::cout << arena << std::endl;
+        std::cout << arena_copy << std::endl;
+
+        // Testing the bulk-load constructor and bulk_insert: duplicated keys keep the last value
+        std::cout << "Testing bulk loading" << std::endl;
+        std::vector<std::pair<int,int>> data{{5,5}, {2,2}, {9,9}, {2,20}, {7,7}, {1,1}, {9,90}};
+        BST<int,int> bulk{data.begin(), data.end()};
+        std::vector<std::pair<int,int>> more{{3,3}, {4,4}, {5,50}, {6,6}};
+        bulk.bulk_insert(more.begin(), more.end(), 2);
+        std::cout << bulk << std::endl;
+        std::cout << "Size: " << bulk.getSize() << ", height: " << bulk.getHeight() << std::endl;
+        bulk.printStructure(std::to_string, "-", ' ');
+
+        // Testing the frozen snapshot
+        std::cout << "Testing the frozen snapshot" << std::endl;
+        FrozenBST<int,int> frozen = bulk.freeze();
+        bulk.insert(std::pair<int,int>{8,8}); // not visible in the snapshot
+        std::cout << frozen << std::endl;
+        std::cout << "The value associated to key 9 is " << frozen[9] << std::endl;
+        std::cout << "Key 8 found: " << (frozen.find(8) != frozen.cend()) << std::endl;
+
+        // Testing the concurrent tree: readers iterate while the writer inserts and balances
+        std::cout << "Testing the concurrent tree" << std::endl;
+        ConcurrentBST<int,int> concurrent;
+        std::atomic<bool> done{false};
+        std::atomic<int> errors{0};
+        std::vector<std::thread> readers;
+        for(int r=0; r<4; ++r)
+                readers.emplace_back([&](){
+                        while(!done){
+                                auto guard = concurrent.read();
+                                int count = 0, previous = -1;
+                                for(auto it = guard->cbegin(); it != guard->cend(); ++it, ++count)
+                                        if((*it)->keyvalue.first <= previous) errors++;
+                                        else previous = (*it)->keyvalue.first;
+                                if(count != guard->getSize()) errors++;
+                        }
+                });
+        for(int i=0; i<200; ++i){
+                concurrent.insert(std::pair<int,int>{(i*37)%200, i});
+                if(i%50 == 0) concurrent.balance();
+        }
+        done = true;
+        for(auto& r : readers) r.join();
+        int value = 0;
+        concurrent.find(100, value);
+        std::cout << "Size: " << concurrent.read()->getSize() << ", value of key 100: " << value << ", reader errors: " << errors << std::endl;
+        // a modification failing on one instance only: the instances are made equal again
+        int applications = 0;
+        try{
+                concurrent.modify([&applications](ConcurrentBST<int,int>::Tree& t){
+                        if(++applications == 1) throw std::runtime_error{"first application"};
+                        t.insert(std::pair<int,int>{1000, 0});
+                });
+        } catch(const std::runtime_error& e){
+                std::cout << "Failed modification: " << e.what() << std::endl;
+        }
+        applications = 0;
+        concurrent.modify([&applications](ConcurrentBST<int,int>::Tree& t){
+                if(++applications == 2) throw std::runtime_error{"second application"};
+                t.insert(std::pair<int,int>{2000, 0});
+        });
+        int sizes[2];
+        for(int& size : sizes){
+                size = concurrent.read()->getSize();
+                concurrent.modify([](ConcurrentBST<int,int>::Tree&){}); // the readers move to the other instance
+        }
+        std::cout << "Sizes of the two instances: " << sizes[0] << " " << sizes[1] << ", key 1000 found: " << concurrent.find(1000, value)
+                  << ", key 2000 found: " << concurrent.find(2000, value) << std::endl;
+
+        // Testing emplace, try_emplace, insert_or_assign and the transparent lookup with string keys
+        std::cout << "Testing emplace and transparent lookup" << std::endl;
+        BST<std::string,std::string,AVLBalancing,HeapAllocation,std::less<>> words;
+        words.emplace("pear", "green");
+        words.emplace("pear", "yellow"); // already present: not modified
+        words.try_emplace("apple", 3, 'r');
+        words.insert_or_assign("plum", "purple");
+        words.insert_or_assign("pear", "brown");
+        words["fig"] = "dark";
+        std::cout << words << std::endl;
+        std::cout << "Value of apple: " << words["apple"] << ", kiwi found: " << (words.find("kiwi") != words.end()) << std::endl;
+        const auto& const_words = words;
+        try{
+                const_words["kiwi"];
+        } catch(const std::out_of_range& e){
+                std::cout << "Constant operator[] on a missing key: " << e.what() << std::endl;
+        }
+
+        // Testing the batched lookup, with unsorted and sorted keys
+        std::cout << "Testing find_many" << std::endl;
+        std::vector<int> batch{7, 2, 12, 5, 9}, sorted_batch{1, 2, 5, 8, 9, 12};
+        std::vector<BST<int,int>::Iterator> results(sorted_batch.size(), bulk.end());
+        bulk.find_many(batch.begin(), batch.end(), results.begin());
+        for(std::size_t i=0; i<batch.size(); ++i)
+                std::cout << batch[i] << (results[i] != bulk.end() ? " found" : " not found") << std::endl;
+        bulk.find_many(sorted_batch.begin(), sorted_batch.end(), results.begin());
+        for(std::size_t i=0; i<sorted_batch.size(); ++i)
+                std::cout << sorted_batch[i] << (results[i] != bulk.end() ? " found" : " not found") << std::endl;
+
+        // Testing the ordered queries and the order statistics
+        std::cout << "Testing order statistics" << std::endl;
+        std::cout << "lower_bound(6): " << (*bulk.lower_bound(6))->keyvalue.first << ", upper_bound(7): " << (*bulk.upper_bound(7))->keyvalue.first << std::endl;
+        std::cout << "Keys in [3, 11):";
+        for(auto node : bulk.range(3, 11))
+                std::cout << " " << node->keyvalue.first;
+        std::cout << std::endl;
+        std::cout << "rank(7): " << bulk.rank(7) << ", select(0): " << (*bulk.select(0))->keyvalue.first << ", count_in_range(3, 11): " << bulk.count_in_range(3, 11) << std::endl;
+        std::cout << "select(size) is end: " << (bulk.select(bulk.getSize()) == bulk.end()) << std::endl;
+
+        // Testing the copy keeping the shape of the original tree, sequential and parallel
+        std::cout << "Testing shape-preserving copy" << std::endl;
+        BST<int,int> parallel_copy{bulk, 4};
+        parallel_copy.printStructure(std::to_string, "-", ' ');
+        parallel_copy = parallel_copy; // self-assignment leaves the tree untouched
+        std::cout << "Size: " << parallel_copy.getSize() << ", height: " << parallel_copy.getHeight() << std::endl;
+
+        // Testing erase: a leaf, a node with one child, a node with two children, the root and a missing key
+        std::cout << "Testing erase" << std::endl;
+        int erased = parallel_copy.erase(1) + parallel_copy.erase(9) + parallel_copy.erase(6) + parallel_copy.erase(4) + parallel_copy.erase(42);
+        std::cout << "Erased: " << erased << std::endl;
+        std::cout << parallel_copy << std::endl;
+        parallel_copy.printStructure(std::to_string, "-", ' ');
+
+        // Testing the parallel visits: the ranges cover the tree in key order and the reduction keeps the order
+        std::cout << "Testing parallel traversal" << std::endl;
+        for(auto& r : bulk.subranges(3)){
+                std::cout << "Range of " << r.size() << " nodes:";
+                for(auto node : r)
+                        std::cout << " " << node->keyvalue.first;
+                std::cout << std::endl;
+        }
+        bulk.parallel_for_each([](std::pair<const int,int>& kv){ kv.second *= 2; }, 3);
+        std::string ordered_keys = bulk.parallel_reduce(std::string{}, [](const std::pair<const int,int>& kv){ return std::to_string(kv.first) + " "; },
+                                                        [](std::string a, const std::string& b){ return a + b; }, 3);
+        int sum = bulk.parallel_reduce(0, [](const std::pair<const int,int>& kv){ return kv.second; }, [](int a, int b){ return a + b; }, 3);
+        std::cout << "Keys: " << ordered_keys << std::endl << "Sum of the doubled values: " << sum << std::endl;
+        try{
+                bulk.parallel_for_each([](std::pair<const int,int>& kv){ if(kv.first == 3) throw std::runtime_error{"visiting key 3"}; }, 3);
+        } catch(const std::runtime_error& e){
+                std::cout << "Exception from a worker: " << e.what() << std::endl;
+        }
+
+        // Testing split, join and the set operations: the nodes are relinked, heights and parents stay consistent
+        std::cout << "Testing split, join and set operations" << std::endl;
+        BST<int,int,AVLBalancing> evens, odds;
+        for(int i=0; i<16; ++i)
+                (i%2 ? odds : evens).insert(std::pair<int,int>{i,i});
+        BST<int,int,AVLBalancing> upper = evens.split(8);
+        std::cout << "Lower part: " << evens.getSize() << " nodes, upper part: " << upper.getSize() << " nodes" << std::endl;
+        BST<int,int,AVLBalancing> joined = BST<int,int,AVLBalancing>::join(std::move(evens), std::move(upper));
+        // splitting on the key of the root: both parts must be detached from the node moved to the upper part
+        BST<int,int,AVLBalancing> pair_tree;
+        pair_tree.insert(std::pair<int,int>{1,1});
+        pair_tree.insert(std::pair<int,int>{0,0});
+        {
+                BST<int,int,AVLBalancing> root_upper = pair_tree.split(1);
+                std::cout << "Split on the root, upper part: " << root_upper;
+        }
+        std::cout << "Split on the root, lower part: " << pair_tree;
+        BST<int,int,AVLBalancing> small_odds;
+        for(int i=1; i<8; i+=2)
+                small_odds.insert(std::pair<int,int>{i,-i});
+        joined.union_with(std::move(odds));
+        std::cout << "Union, size: " << joined.getSize() << ", height: " << joined.getHeight() << std::endl;
+        joined.printStructure(std::to_string, "-", ' ');
+        BST<int,int,AVLBalancing> intersection{joined};
+        intersection.intersect_with(BST<int,int,AVLBalancing>{small_odds});
+        std::cout << "Intersection:" << std::endl << intersection << std::endl;
+        joined.difference_with(std::move(small_odds));
+        std::cout << "Difference:" << std::endl << joined << std::endl;
+
+        // Testing the binary snapshot: saved to a file and mapped back in memory
+        std::cout << "Testing save and load_mapped" << std::endl;
+        joined.save("snapshot_test.bin");
+        FrozenBST<int,int> mapped = BST<int,int,AVLBalancing>::load_mapped("snapshot_test.bin");
+        std::cout << "Mapped size: " << mapped.getSize() << ", value of key 10: " << mapped[10] << ", key 3 found: " << (mapped.find(3) != mapped.cend()) << std::endl;
+        std::cout << mapped << std::endl;
+        try{
+                BST<long,double>::load_mapped("snapshot_test.bin");
+        } catch(const std::runtime_error& e){
+                std::cout << "Loading with other types: " << e.what() << std::endl;
+        }
+        // a truncated file, and a header whose offsets make offset + count * sizeof(int) wrap around to a small number
+        std::string snapshot;
+        {
+                std::ifstream in{"snapshot_test.bin", std::ios::binary};
+                snapshot.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+        }
+        std::string truncated = snapshot.substr(0, snapshot.size() - 8);
+        std::string wrapping = snapshot;
+        const std::uint64_t wrapping_count = 64, wrapping_offset = std::uint64_t(0) - 192; // 2^64 - 192 + 64 * 4 wraps to 64
+        // count and offsets follow magic, version, byte order and sizes
+        std::memcpy(&wrapping[24], &wrapping_count, sizeof(wrapping_count));
+        std::memcpy(&wrapping[32], &wrapping_offset, sizeof(wrapping_offset));
+        std::memcpy(&wrapping[40], &wrapping_offset, sizeof(wrapping_offset));
+        for(const std::string* bytes : {&truncated, &wrapping}){
+                {
+                        std::ofstream out{"snapshot_test.bin", std::ios::binary | std::ios::trunc};
+                        out.write(bytes->data(), std::streamsize(bytes->size()));
+                }
+                try{
+                        BST<int,int,AVLBalancing>::load_mapped("snapshot_test.bin");
+                } catch(const std::runtime_error& e){
+                        std::cout << "Loading a corrupted file: " << e.what() << std::endl;
+                }
+        }
+        std::remove("snapshot_test.bin");
+
+        // Testing the statistics policy: a degenerate tree has an average depth far above log2(size)
+        std::cout << "Testing statistics" << std::endl;
+        BST<int,int,NoBalancing,HeapAllocation,std::less<int>,CountingStats> counted;
+        for(int i=0; i<15; ++i)
+                counted.insert(std::pair<int,int>{i,i});
+        TreeStats before = counted.stats();
+        counted.balance();
+        counted.reset_stats();
+        counted.find(0);
+        counted.find(7);
+        counted.find(42);
+        TreeStats after = counted.stats();
+        std::cout << "Before balance: height " << before.height << ", average depth " << before.average_depth << ", nodes created " << before.allocations
+                  << ", comparisons per insert " << double(before.insert_comparisons) / before.inserts << std::endl;
+        std::cout << "After balance: height " << after.height << ", average depth " << after.average_depth << ", lookups " << after.finds
+                  << ", comparisons per lookup " << double(after.find_comparisons) / after.finds << std::endl;
+        std::cout << "Lookup depths:";
+        for(int d=0; d<=after.height; ++d)
+                std::cout << " " << after.depth_histogram[d];
+        std::cout << std::endl;
+
+        // Testing the B-tree: with four keys per node 20 keys already need three levels
+        std::cout << "Testing BTree" << std::endl;
+        BTree<int,int,4> btree;
+        for(int i=0; i<20; ++i)
+                btree.insert(std::pair<int,int>{(7*i)%20, i});
+        btree[3] = 33;
+        btree[25] = 25;
+        std::cout << "Size " << btree.getSize() << ", levels " << btree.getHeight() << ", found 14: " << (btree.find(14) != btree.end())
+                  << ", found 21: " << (btree.find(21) != btree.end()) << std::endl;
+        BTree<int,int,4> btree_copy{btree};
+        for(auto it = btree_copy.cbegin(); it != btree_copy.cend(); ++it)
+                std::cout << it.key() << ":" << it.value() << " ";
+        std::cout << std::endl;
+        const BTree<int,int,4>& const_btree = btree;
+        try{
+                const_btree[21];
+        } catch(const std::out_of_range& e){
+                std::cout << "Constant operator[] on a missing key: " << e.what() << std::endl;
+        }
+
+        // Testing the structure export: every node is visited once, a budget cuts the output on huge trees
+        std::cout << "Testing exportStructure" << std::endl;
+        BST<int,int> exported;
+        for(int k : {8, 3, 10, 1, 6, 14, 4, 7, 13})
+                exported.insert(std::pair<int,int>{k,k});
+        exported.exportStructure(std::cout, ExportFormat::level_order, std::to_string);
+        exported.exportStructure(std::cout, ExportFormat::dot, std::to_string, nullptr, 1);
+        exported.exportStructure(std::cout, ExportFormat::json, std::to_string, std::to_string, -1, 3);
+        BST<int,int> degenerate;
+        for(int i=0; i<25000; ++i)
+                degenerate.insert(std::pair<int,int>{i,i});
+        degenerate.exportStructure(std::cout, ExportFormat::level_order, std::to_string, nullptr, 3);
+
 
         
 }
\ No newline at end of file